@@ -19,17 +19,24 @@
  */
 
 #include <iostream>
-using std::cin;
 using std::cout;
 using std::endl;
 
 #include <string>
 using std::string;
 
+#include <vector>
+using std::vector;
+
 #include "aggr.h"
+#include "input.h"
+#include "number.h"
 
 const string usage("Usage: aggr <aggr-constr-str>");
 
+// The number of the values passed on to the aggregator at once.
+const size_t BATCH_SIZE = 4096;
+
 int main(int argc, char** argv) {
 	try {
 		if(argc != 2)
@@ -37,15 +44,43 @@ int main(int argc, char** argv) {
 
 		auto aggr = aggr::create_from_string(argv[1]);
 
-		while(true) {
-			double value;
-			cin >> value;
+		input::source in;
+		input::field line;
+		input::row words;
 
-			if(cin.fail())
-				break;
+		// The aggregators of text take all the words as they are.
+		if(aggr->takes_text()) {
+			while(in.next_line(line)) {
+				input::split_words(line, words);
+				for(input::field const& w : words)
+					aggr->put_text(w.data, w.size);
+			}
+			cout << aggr->get() << endl;
+			return 0;
+		}
 
-			aggr->put(value);
+		// Read the numbers until the end of the input or until something
+		// that is not a number is found. The numbers are passed on to the
+		// aggregator in batches.
+		vector<double> batch;
+		batch.reserve(BATCH_SIZE);
+		bool numbers = true;
+		while(numbers && in.next_line(line)) {
+			input::split_words(line, words);
+			for(input::field const& w : words) {
+				double value;
+				if(!number::parse_double(w.data, w.data + w.size, value)) {
+					numbers = false;
+					break;
+				}
+				batch.push_back(value);
+				if(batch.size() == BATCH_SIZE) {
+					aggr->put_batch(batch.data(), batch.size());
+					batch.clear();
+				}
+			}
 		}
+		aggr->put_batch(batch.data(), batch.size());
 
 		cout << aggr->get() << endl;
 
@@ -29,10 +29,46 @@ using std::stringstream;
 
 #include <memory>
 using std::unique_ptr;
+using std::shared_ptr;
+
+#include <vector>
+using std::vector;
+
+#include <cstdint>
 
 #include <limits>
 using std::numeric_limits;
 
+#include <cstddef>
+using std::size_t;
+
+#include <utility>
+using std::pair;
+
+#include <algorithm>
+using std::sort;
+using std::nth_element;
+
+#include <queue>
+using std::priority_queue;
+
+#include <functional>
+using std::greater;
+
+#include <cmath>
+using std::ceil;
+using std::floor;
+using std::pow;
+using std::ldexp;
+using std::log;
+
+#include <cstring>
+using std::memcpy;
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include <boost/math/distributions/normal.hpp>
 using boost::math::normal;
 
@@ -40,11 +76,227 @@ using boost::math::normal;
 using boost::xpressive::sregex;
 using boost::xpressive::smatch;
 using boost::xpressive::s1;
+using boost::xpressive::s2;
 using boost::xpressive::_d;
 using boost::xpressive::_s;
 
+#include "input.h"
+#include "spill.h"
+
 namespace aggr {
 
+	// The batch processing kernels. On x86-64 the SSE2 variants are the
+	// baseline and the AVX2 ones are selected at runtime if the processor
+	// supports them. Elsewhere the plain loops are used. Note that the
+	// vectorized sums add the values up in a different order than the
+	// sequential ones, so the results may differ by the rounding.
+	namespace kernel {
+
+		// The plain variants.
+		// -------------------
+
+		inline double sum_plain(double const* values, size_t size) {
+			double result = 0;
+			for(size_t i = 0; i < size; ++i)
+				result += values[i];
+			return result;
+		}
+
+		inline double min_plain(double const* values, size_t size, double init) {
+			for(size_t i = 0; i < size; ++i)
+				if(values[i] < init)
+					init = values[i];
+			return init;
+		}
+
+		inline double max_plain(double const* values, size_t size, double init) {
+			for(size_t i = 0; i < size; ++i)
+				if(values[i] > init)
+					init = values[i];
+			return init;
+		}
+
+		inline double sq_dev_plain(double const* values, size_t size, double mean) {
+			double result = 0;
+			for(size_t i = 0; i < size; ++i)
+				result += (values[i] - mean) * (values[i] - mean);
+			return result;
+		}
+
+#if defined(__x86_64__)
+
+		// The SSE2 variants.
+		// ------------------
+		// Note that the min and max instructions return the second operand
+		// if any of them is NaN, so the NaNs are skipped just like by the
+		// comparisons in the plain variants.
+
+		inline double sum_sse2(double const* values, size_t size) {
+			__m128d acc0 = _mm_setzero_pd();
+			__m128d acc1 = _mm_setzero_pd();
+			size_t i = 0;
+			for(; i + 4 <= size; i += 4) {
+				acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+				acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+			}
+			double lanes[2];
+			_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+			return lanes[0] + lanes[1] + sum_plain(values + i, size - i);
+		}
+
+		inline double min_sse2(double const* values, size_t size, double init) {
+			__m128d acc = _mm_set1_pd(init);
+			size_t i = 0;
+			for(; i + 2 <= size; i += 2)
+				acc = _mm_min_pd(_mm_loadu_pd(values + i), acc);
+			double lanes[2];
+			_mm_storeu_pd(lanes, acc);
+			return min_plain(values + i, size - i, min_plain(lanes, 2, init));
+		}
+
+		inline double max_sse2(double const* values, size_t size, double init) {
+			__m128d acc = _mm_set1_pd(init);
+			size_t i = 0;
+			for(; i + 2 <= size; i += 2)
+				acc = _mm_max_pd(_mm_loadu_pd(values + i), acc);
+			double lanes[2];
+			_mm_storeu_pd(lanes, acc);
+			return max_plain(values + i, size - i, max_plain(lanes, 2, init));
+		}
+
+		inline double sq_dev_sse2(double const* values, size_t size, double mean) {
+			__m128d m = _mm_set1_pd(mean);
+			__m128d acc = _mm_setzero_pd();
+			size_t i = 0;
+			for(; i + 2 <= size; i += 2) {
+				__m128d d = _mm_sub_pd(_mm_loadu_pd(values + i), m);
+				acc = _mm_add_pd(acc, _mm_mul_pd(d, d));
+			}
+			double lanes[2];
+			_mm_storeu_pd(lanes, acc);
+			return lanes[0] + lanes[1] + sq_dev_plain(values + i, size - i, mean);
+		}
+
+		// The AVX2 variants.
+		// ------------------
+
+		__attribute__((target("avx2")))
+		inline double sum_avx2(double const* values, size_t size) {
+			__m256d acc0 = _mm256_setzero_pd();
+			__m256d acc1 = _mm256_setzero_pd();
+			size_t i = 0;
+			for(; i + 8 <= size; i += 8) {
+				acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(values + i));
+				acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(values + i + 4));
+			}
+			double lanes[4];
+			_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+			return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+				sum_plain(values + i, size - i);
+		}
+
+		__attribute__((target("avx2")))
+		inline double min_avx2(double const* values, size_t size, double init) {
+			__m256d acc = _mm256_set1_pd(init);
+			size_t i = 0;
+			for(; i + 4 <= size; i += 4)
+				acc = _mm256_min_pd(_mm256_loadu_pd(values + i), acc);
+			double lanes[4];
+			_mm256_storeu_pd(lanes, acc);
+			return min_plain(values + i, size - i, min_plain(lanes, 4, init));
+		}
+
+		__attribute__((target("avx2")))
+		inline double max_avx2(double const* values, size_t size, double init) {
+			__m256d acc = _mm256_set1_pd(init);
+			size_t i = 0;
+			for(; i + 4 <= size; i += 4)
+				acc = _mm256_max_pd(_mm256_loadu_pd(values + i), acc);
+			double lanes[4];
+			_mm256_storeu_pd(lanes, acc);
+			return max_plain(values + i, size - i, max_plain(lanes, 4, init));
+		}
+
+		__attribute__((target("avx2")))
+		inline double sq_dev_avx2(double const* values, size_t size, double mean) {
+			__m256d m = _mm256_set1_pd(mean);
+			__m256d acc = _mm256_setzero_pd();
+			size_t i = 0;
+			for(; i + 4 <= size; i += 4) {
+				__m256d d = _mm256_sub_pd(_mm256_loadu_pd(values + i), m);
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(d, d));
+			}
+			double lanes[4];
+			_mm256_storeu_pd(lanes, acc);
+			return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+				sq_dev_plain(values + i, size - i, mean);
+		}
+
+		inline bool has_avx2() {
+			static const bool result = __builtin_cpu_supports("avx2");
+			return result;
+		}
+
+		// The dispatching functions.
+		// --------------------------
+
+		inline double sum(double const* values, size_t size) {
+			return has_avx2()
+				? sum_avx2(values, size)
+				: sum_sse2(values, size);
+		}
+
+		inline double min(double const* values, size_t size, double init) {
+			return has_avx2()
+				? min_avx2(values, size, init)
+				: min_sse2(values, size, init);
+		}
+
+		inline double max(double const* values, size_t size, double init) {
+			return has_avx2()
+				? max_avx2(values, size, init)
+				: max_sse2(values, size, init);
+		}
+
+		inline double sq_dev(double const* values, size_t size, double mean) {
+			return has_avx2()
+				? sq_dev_avx2(values, size, mean)
+				: sq_dev_sse2(values, size, mean);
+		}
+#else
+		inline double sum(double const* values, size_t size) {
+			return sum_plain(values, size);
+		}
+
+		inline double min(double const* values, size_t size, double init) {
+			return min_plain(values, size, init);
+		}
+
+		inline double max(double const* values, size_t size, double init) {
+			return max_plain(values, size, init);
+		}
+
+		inline double sq_dev(double const* values, size_t size, double mean) {
+			return sq_dev_plain(values, size, mean);
+		}
+#endif
+	}
+
+	class store;
+
+	// The moments of a stream of numbers: the count, the running mean, the
+	// sum of the squared deviations from the mean, the extremes and the sum.
+	// Many of the aggregators may compute their values from these alone, so
+	// the aggregators of the same values may share them (see groupby.h).
+	struct moments_state {
+		double n;
+		double mean;
+		double m2;
+		double min;
+		double max;
+		double sum;
+	};
+
 	// The class defines an interface for the objects that aggregate streams
 	// of numbers. The way to use an aggregator is to first feed it with
 	// a serie of numbers and then query it for the according aggregation.
@@ -57,113 +309,966 @@ namespace aggr {
 		// Add a value to the distribution.
 		virtual void put(double value) = 0;
 
+		// Add a number of values at once. The aggregators that can process
+		// the values faster in bulk override this.
+		virtual void put_batch(double const* values, size_t size) {
+			for(size_t i = 0; i < size; ++i)
+				put(values[i]);
+		}
+
+		// Tells whether the aggregator takes the text of the input fields
+		// rather than the numbers parsed from them.
+		virtual bool takes_text() const {
+			return false;
+		}
+
+		// Add a value given as text. Only supported by the aggregators that
+		// take text.
+		virtual void put_text(char const* data, size_t size) = 0;
+
 		// Gets the aggregated value.
 		virtual double get() const = 0;
+
+		// Tells whether the aggregated value may be computed from the
+		// moments of the values.
+		virtual bool uses_moments() const {
+			return false;
+		}
+
+		// Computes the aggregated value from the moments of the values.
+		// Only supported by the aggregators that use the moments.
+		virtual double value_of(moments_state const&) const {
+			throw string("The aggregator doesn't use the moments.");
+		}
+
+		// Creates a copy of this aggregator including its current state.
+		virtual unique_ptr<aggregator> clone() const = 0;
+
+		// Merges the state of another aggregator of the same type, so that
+		// this one yields the aggregation of the values put in either one.
+		virtual void merge(aggregator const& other) = 0;
+
+		// Creates an empty store for the states of many aggregators
+		// configured like this one.
+		virtual unique_ptr<store> make_store() const = 0;
 	};
 
 	// Helper typedef.
 	typedef unique_ptr<aggregator> ptr;
 
+	// The class defines an interface for the storage of the states of many
+	// aggregators of the same kind, e.g. one for each group of the data.
+	// The states are kept in a contiguous array and are referred to by their
+	// indices, called slots. Unlike with the separate aggregator objects
+	// there is no per-state allocation and no per-value dynamic dispatch
+	// when the values are put in bulk.
+	class store {
+	public:
+		virtual ~store() {}
+
+		// Appends a slot in the initial state and returns its index.
+		virtual uint32_t add() = 0;
+
+		// Gets the number of the slots.
+		virtual uint32_t size() const = 0;
+
+		// Brings the state in a given slot back to the initial one.
+		virtual void reset(uint32_t slot) = 0;
+
+		// Add a value to the state in a given slot.
+		virtual void put(uint32_t slot, double value) = 0;
+
+		// Add a number of values, each one to the state in the respective
+		// slot from the given list.
+		virtual void put_scatter(uint32_t const* slots, double const* values,
+				size_t size) = 0;
+
+		// Add a value given as text to the state in a given slot.
+		virtual void put_text(uint32_t slot, char const* data, size_t size) = 0;
+
+		// Gets the aggregated value of the state in a given slot.
+		virtual double get(uint32_t slot) const = 0;
+
+		// Merges the state from a slot of another store of the same kind.
+		virtual void merge(uint32_t slot, store const& other,
+				uint32_t other_slot) = 0;
+
+		// Gets the number of the bytes occupied by the states.
+		virtual size_t memory() const = 0;
+	};
+
+	// Helper typedef.
+	typedef unique_ptr<store> store_ptr;
+
+	// Casts an aggregator to be merged to the type of the merging one.
+	template<class T>
+	T const& merged_as(aggregator const& other) {
+		T const* result = dynamic_cast<T const*>(&other);
+		if(!result)
+			throw string("Attempted merging aggregators of different types.");
+		return *result;
+	}
+
+	// The store of the states of the aggregators of type D.
+	template<class D>
+	class basic_store : public store {
+		typedef typename D::state_type state_type;
+
+		D _config;
+		vector<state_type> _states;
+
+	public:
+		basic_store(D const& config) : _config(config) {}
+
+		uint32_t add() {
+			_states.push_back(D::initial());
+			return _states.size() - 1;
+		}
+
+		uint32_t size() const {
+			return _states.size();
+		}
+
+		void reset(uint32_t slot) {
+			_states[slot] = D::initial();
+		}
+
+		void put(uint32_t slot, double value) {
+			_config.update(_states[slot], value);
+		}
+
+		void put_scatter(uint32_t const* slots, double const* values,
+				size_t size) {
+			for(size_t i = 0; i < size; ++i)
+				_config.update(_states[slots[i]], values[i]);
+		}
+
+		void put_text(uint32_t slot, char const* data, size_t size) {
+			_config.update_text(_states[slot], data, size);
+		}
+
+		double get(uint32_t slot) const {
+			return _config.value(_states[slot]);
+		}
+
+		// Gets the state in a given slot.
+		state_type const& state(uint32_t slot) const {
+			return _states[slot];
+		}
+
+		void merge(uint32_t slot, store const& other, uint32_t other_slot) {
+			basic_store const* o = dynamic_cast<basic_store const*>(&other);
+			if(!o)
+				throw string("Attempted merging stores of different types.");
+			_config.combine(_states[slot], o->_states[other_slot]);
+		}
+
+		size_t memory() const {
+			size_t result = _states.capacity() * sizeof(state_type);
+			for(auto const& s : _states)
+				result += _config.heap_memory(s);
+			return result;
+		}
+	};
+
+	// The common implementation of the aggregators that keep their state in
+	// a plain structure S. The derived class D defines the functions that
+	// operate on the state:
+	// - static initial() : S -- the state before any value is put,
+	// - update(S&, double) -- adds a value,
+	// - combine(S&, S const&) -- merges another state,
+	// - value(S const&) : double -- computes the aggregated value,
+	// and optionally update_batch(S&, double const*, size_t),
+	// heap_memory(S const&) : size_t for the states that allocate memory and
+	// update_text(S&, char const*, size_t) for the aggregators of text.
+	// As these functions aren't virtual, the states can be kept compactly in
+	// a basic_store and processed without the dynamic dispatch. The derived
+	// class only holds the configuration, e.g. the confidence level.
+	template<class D, class S>
+	class basic : public aggregator {
+		S _state;
+
+		D const& self() const {
+			return static_cast<D const&>(*this);
+		}
+
+	public:
+		typedef S state_type;
+
+		basic() : _state(D::initial()) {}
+
+		// The default, value by value, batch update.
+		void update_batch(S& state, double const* values, size_t size) const {
+			for(size_t i = 0; i < size; ++i)
+				self().update(state, values[i]);
+		}
+
+		// The memory allocated by a state, besides its own size.
+		size_t heap_memory(S const&) const {
+			return 0;
+		}
+
+		// Most of the aggregators only take numbers.
+		void update_text(S&, char const*, size_t) const {
+			throw string("The aggregator doesn't take text values.");
+		}
+
+		S const& get_state() const {
+			return _state;
+		}
+
+		void put(double value) {
+			self().update(_state, value);
+		}
+
+		void put_batch(double const* values, size_t size) {
+			self().update_batch(_state, values, size);
+		}
+
+		void put_text(char const* data, size_t size) {
+			self().update_text(_state, data, size);
+		}
+
+		double get() const {
+			return self().value(_state);
+		}
+
+		ptr clone() const {
+			return ptr(new D(self()));
+		}
+
+		void merge(aggregator const& other) {
+			self().combine(_state, merged_as<D>(other).get_state());
+		}
+
+		store_ptr make_store() const {
+			return store_ptr(new basic_store<D>(self()));
+		}
+	};
+
 	// Count of the elements put so far.
-	class count : public aggregator {
-		int _count;
+	class count : public basic<count, uint64_t> {
+	public:
+		static uint64_t initial() { return 0; }
+		void update(uint64_t& s, double) const { ++s; }
+		void update_batch(uint64_t& s, double const*, size_t size) const { s += size; }
+		void combine(uint64_t& s, uint64_t o) const { s += o; }
+		double value(uint64_t s) const { return double(s); }
+		bool uses_moments() const { return true; }
+		double value_of(moments_state const& m) const { return m.n; }
+	};
+
+	// The minimum from the elements put so far.
+	class min : public basic<min, double> {
 	public:
-		count() : _count(0) {}
-		void put(double) { ++_count; }
-		double get() const { return double(_count); }
-	};
-
-    // The minimum from the elements put so far.
-    class min : public aggregator {
-        double _min;
-    public:
-        min() : _min(numeric_limits<double>::infinity()) {}
-        void put(double value) { if(value < _min) _min = value; }
-        double get() const { return _min; }
-    };
-
-    // The maximum from the elements put so far.
-    class max : public aggregator {
-        double _max;
-    public:
-        max() : _max(-numeric_limits<double>::infinity()) {}
-        void put(double value) { if(value > _max) _max = value; }
-        double get() const { return _max; }
-    };
+		static double initial() { return numeric_limits<double>::infinity(); }
+		void update(double& s, double value) const { if(value < s) s = value; }
+		void update_batch(double& s, double const* values, size_t size) const {
+			s = kernel::min(values, size, s);
+		}
+		void combine(double& s, double o) const { update(s, o); }
+		double value(double s) const { return s; }
+		bool uses_moments() const { return true; }
+		double value_of(moments_state const& m) const { return m.min; }
+	};
+
+	// The maximum from the elements put so far.
+	class max : public basic<max, double> {
+	public:
+		static double initial() { return -numeric_limits<double>::infinity(); }
+		void update(double& s, double value) const { if(value > s) s = value; }
+		void update_batch(double& s, double const* values, size_t size) const {
+			s = kernel::max(values, size, s);
+		}
+		void combine(double& s, double o) const { update(s, o); }
+		double value(double s) const { return s; }
+		bool uses_moments() const { return true; }
+		double value_of(moments_state const& m) const { return m.max; }
+	};
 
 	// Sums the numbers that have been put into it so far.
-	class sum : public aggregator {
-		double _sum;
+	class sum : public basic<sum, double> {
 	public:
-		sum() : _sum(0) {}
-		void put(double value) { _sum += value; }
-		double get() const { return _sum; }
+		static double initial() { return 0; }
+		void update(double& s, double value) const { s += value; }
+		void update_batch(double& s, double const* values, size_t size) const {
+			s += kernel::sum(values, size);
+		}
+		void combine(double& s, double o) const { s += o; }
+		double value(double s) const { return s; }
+		bool uses_moments() const { return true; }
+		double value_of(moments_state const& m) const { return m.sum; }
+	};
+
+	// The state of the mean aggregator: the sum and the count of the values.
+	struct mean_state {
+		double sum;
+		double count;
 	};
 
 	// Computs the mean of the values that have been put into it.
-	// Note that it depends on two other aggregators : sum and count.
-	class mean : public aggregator {
-		sum _sum;
-		count _count;
+	class mean : public basic<mean, mean_state> {
 	public:
-		void put(double value) {
-			_sum.put(value);
-			_count.put(value);
+		static mean_state initial() {
+			return { 0, 0 };
 		}
 
-		double get() const {
-			return _sum.get() / _count.get();
+		void update(mean_state& s, double value) const {
+			s.sum += value;
+			s.count += 1.0;
+		}
+
+		void update_batch(mean_state& s, double const* values, size_t size) const {
+			s.sum += kernel::sum(values, size);
+			s.count += double(size);
+		}
+
+		void combine(mean_state& s, mean_state const& o) const {
+			s.sum += o.sum;
+			s.count += o.count;
+		}
+
+		double value(mean_state const& s) const {
+			return s.sum / s.count;
+		}
+
+		bool uses_moments() const {
+			return true;
+		}
+
+		double value_of(moments_state const& m) const {
+			return value({ m.sum, m.n });
 		}
 	};
 
+	// The state of the running standard deviation algorithm: the running
+	// mean, the sum of the squared deviations and the count of the values.
+	struct stdev_state {
+		double a;
+		double q;
+		double k;
+	};
+
 	// Computes the standard deviation of the population
 	// based on the input data interpreted as the sample.
 	// The implementation is based on the algorithm for the
 	// running standard deviation from the Wikipedia.
-	class stdev : public aggregator {
-		double _a;
-		double _q;
-		double _k;
+	class stdev : public basic<stdev, stdev_state> {
 	public:
-		stdev() : _a(0), _q(0), _k(0) {}
-	
-		void put(double value) {
-			double new_a = _a + (value - _a) / (_k + 1);
-			double new_q = _q + (value - _a) * (value - new_a);
-			_a = new_a;
-			_q = new_q;			
-			_k += 1.0;
+		static stdev_state initial() {
+			return { 0, 0, 0 };
 		}
 
-		double get() const {
-			return sqrt(_q / (_k - 1));
+		void update(stdev_state& s, double value) const {
+			double new_a = s.a + (value - s.a) / (s.k + 1);
+			double new_q = s.q + (value - s.a) * (value - new_a);
+			s.a = new_a;
+			s.q = new_q;
+			s.k += 1.0;
+		}
+
+		// The values are processed in blocks. The mean and the sum of the
+		// squared deviations of each block are computed with the two-pass
+		// algorithm, and then the block is combined with the running state
+		// just like another state would be merged.
+		void update_batch(stdev_state& s, double const* values, size_t size) const {
+			static const size_t BLOCK_SIZE = 1024;
+			for(size_t i = 0; i < size; i += BLOCK_SIZE) {
+				size_t block = size - i < BLOCK_SIZE ? size - i : BLOCK_SIZE;
+				stdev_state part;
+				part.k = double(block);
+				part.a = kernel::sum(values + i, block) / part.k;
+				part.q = kernel::sq_dev(values + i, block, part.a);
+				combine(s, part);
+			}
 		}
+
+		// Combines the running states with the parallel variant of the
+		// algorithm (Chan et al.).
+		void combine(stdev_state& s, stdev_state const& o) const {
+			if(o.k == 0)
+				return;
+
+			double k = s.k + o.k;
+			double delta = o.a - s.a;
+			s.a += delta * o.k / k;
+			s.q += o.q + delta * delta * s.k * o.k / k;
+			s.k = k;
+		}
+
+		double value(stdev_state const& s) const {
+			return sqrt(s.q / (s.k - 1));
+		}
+
+		bool uses_moments() const {
+			return true;
+		}
+
+		double value_of(moments_state const& m) const {
+			return value({ m.mean, m.m2, m.n });
+		}
+	};
+
+	// The state of the confidence interval aggregator.
+	struct ci_gauss_state {
+		mean_state m;
+		stdev_state s;
 	};
 
 	// Computes the gaussian confidence interval of the values that are
 	// put into it. Note that it depends on the boost statistical helpers.
-	class ci_gauss : public aggregator {
+	class ci_gauss : public basic<ci_gauss, ci_gauss_state> {
 		double _alpha;
-		count _count;
 		mean _mean;
 		stdev _stdev;
 	public:
 		ci_gauss(double alpha) : _alpha(alpha) {}
 
-		void put(double value) {
-			_count.put(value);
-			_mean.put(value);
-			_stdev.put(value);
+		static ci_gauss_state initial() {
+			return { mean::initial(), stdev::initial() };
 		}
 
-		double get() const {
-			normal dist(_mean.get(), _stdev.get() / sqrt(_count.get()));
+		void update(ci_gauss_state& s, double value) const {
+			_mean.update(s.m, value);
+			_stdev.update(s.s, value);
+		}
+
+		void update_batch(ci_gauss_state& s, double const* values, size_t size) const {
+			_mean.update_batch(s.m, values, size);
+			_stdev.update_batch(s.s, values, size);
+		}
+
+		void combine(ci_gauss_state& s, ci_gauss_state const& o) const {
+			_mean.combine(s.m, o.m);
+			_stdev.combine(s.s, o.s);
+		}
+
+		double value(ci_gauss_state const& s) const {
+			normal dist(_mean.value(s.m), _stdev.value(s.s) / sqrt(s.m.count));
 			double lower_p = (1.0 - _alpha) * 0.5;
 			double upper_p = lower_p + _alpha;
 			double lower = quantile(dist, lower_p);
 			double upper = quantile(dist, upper_p);
 			return upper - lower;
 		}
+
+		bool uses_moments() const {
+			return true;
+		}
+
+		double value_of(moments_state const& m) const {
+			return value({ { m.sum, m.n }, { m.mean, m.m2, m.n } });
+		}
+	};
+
+	// Keeps all the moments of the values. It isn't meant to be used on its
+	// own, but to back the aggregators that use the moments, which then
+	// share a single state updated once per value. The updates are the same
+	// as in the respective aggregators, so the results are the same too.
+	// Its own value is the mean.
+	class moments : public basic<moments, moments_state> {
+		stdev _stdev;
+
+	public:
+		static moments_state initial() {
+			return { 0, 0, 0,
+				numeric_limits<double>::infinity(),
+				-numeric_limits<double>::infinity(),
+				0 };
+		}
+
+		void update(moments_state& s, double value) const {
+			double new_mean = s.mean + (value - s.mean) / (s.n + 1);
+			s.m2 = s.m2 + (value - s.mean) * (value - new_mean);
+			s.mean = new_mean;
+			s.n += 1.0;
+			if(value < s.min)
+				s.min = value;
+			if(value > s.max)
+				s.max = value;
+			s.sum += value;
+		}
+
+		void update_batch(moments_state& s, double const* values, size_t size) const {
+			stdev_state st = { s.mean, s.m2, s.n };
+			_stdev.update_batch(st, values, size);
+			s.mean = st.a;
+			s.m2 = st.q;
+			s.n = st.k;
+			s.min = kernel::min(values, size, s.min);
+			s.max = kernel::max(values, size, s.max);
+			s.sum += kernel::sum(values, size);
+		}
+
+		void combine(moments_state& s, moments_state const& o) const {
+			stdev_state st = { s.mean, s.m2, s.n };
+			_stdev.combine(st, { o.mean, o.m2, o.n });
+			s.mean = st.a;
+			s.m2 = st.q;
+			s.n = st.k;
+			if(o.min < s.min)
+				s.min = o.min;
+			if(o.max > s.max)
+				s.max = o.max;
+			s.sum += o.sum;
+		}
+
+		double value(moments_state const& s) const {
+			return s.sum / s.n;
+		}
+	};
+
+	// The store of the moments shared by a number of aggregators.
+	typedef basic_store<moments> moments_store;
+
+	// The state of the quantile sketch. The level h keeps the items that
+	// stand for 2^h of the values each.
+	struct quantile_state {
+		vector<vector<double>> levels;
+		uint64_t n;		// The number of the values put.
+		uint32_t size;		// The number of the items in all the levels.
+		uint32_t capacity;	// The total capacity of the levels.
+		uint64_t random;	// The state of the coin flips.
+	};
+
+	// Estimates a quantile of the values with the KLL sketch (Karnin, Lang
+	// and Liberty). The values are collected at the lowest level. When a
+	// level gets full it is sorted and every other item, starting at random
+	// from the first or the second one, is promoted to the next level with
+	// a doubled weight. The capacities decrease geometrically from the top
+	// level of k items downwards, so at most about 3k items are kept
+	// regardless of the number of the values. The sketches are merged by
+	// concatenating their levels and compacting the result.
+	//
+	// The estimate is a value whose rank differs from the requested one by
+	// at most about 1.7% of the number of the values for k = 200 with the
+	// 99% confidence, with the error inversely proportional to k. The coin
+	// flips are seeded deterministically, so the results are reproducible.
+	// The NaN values are ignored.
+	class quantile : public basic<quantile, quantile_state> {
+		double _p;
+		uint32_t _k;
+
+		// The capacity of a level given the number of the levels.
+		uint32_t level_capacity(size_t level, size_t levels) const {
+			double capacity = ceil(_k * pow(2.0 / 3.0, double(levels - level - 1)));
+			return capacity < 2.0 ? 2 : uint32_t(capacity);
+		}
+
+		uint32_t total_capacity(size_t levels) const {
+			uint32_t result = 0;
+			for(size_t h = 0; h < levels; ++h)
+				result += level_capacity(h, levels);
+			return result;
+		}
+
+		static bool flip(quantile_state& s) {
+			s.random ^= s.random << 13;
+			s.random ^= s.random >> 7;
+			s.random ^= s.random << 17;
+			return s.random & 1;
+		}
+
+		// Compacts the lowest level that has reached its capacity.
+		void compact(quantile_state& s) const {
+			for(size_t h = 0; h < s.levels.size(); ++h) {
+				if(s.levels[h].size() < level_capacity(h, s.levels.size()))
+					continue;
+
+				if(h + 1 == s.levels.size()) {
+					s.levels.emplace_back();
+					s.capacity = total_capacity(s.levels.size());
+				}
+
+				vector<double>& level = s.levels[h];
+				vector<double>& next = s.levels[h + 1];
+				sort(begin(level), end(level));
+
+				// An odd item stays at its level.
+				bool odd = level.size() % 2 == 1;
+				double kept = level.back();
+				if(odd)
+					level.pop_back();
+
+				for(size_t i = flip(s) ? 1 : 0; i < level.size(); i += 2)
+					next.push_back(level[i]);
+
+				s.size -= level.size() / 2;
+				level.clear();
+				if(odd)
+					level.push_back(kept);
+
+				// The lower levels shrink as the sketch grows.
+				uint32_t capacity = level_capacity(h, s.levels.size());
+				if(level.capacity() > 2 * capacity) {
+					vector<double> shrunk;
+					shrunk.reserve(capacity);
+					shrunk.insert(end(shrunk), begin(level), end(level));
+					level.swap(shrunk);
+				}
+				return;
+			}
+		}
+
+		void init(quantile_state& s) const {
+			if(s.levels.empty()) {
+				s.levels.emplace_back();
+				s.capacity = total_capacity(1);
+			}
+		}
+
+	public:
+		quantile(double p, uint32_t k) : _p(p), _k(k) {
+			if(!(p >= 0.0 && p <= 1.0))
+				throw string("The quantile must be between 0 and 1.");
+			if(k < 8)
+				throw string("The quantile sketch size must be at least 8.");
+		}
+
+		static quantile_state initial() {
+			return { {}, 0, 0, 0, 88172645463325252ULL };
+		}
+
+		void update(quantile_state& s, double value) const {
+			if(value != value)
+				return;
+
+			init(s);
+			s.levels[0].push_back(value);
+			++s.size;
+			++s.n;
+			if(s.size > s.capacity)
+				compact(s);
+		}
+
+		void combine(quantile_state& s, quantile_state const& o) const {
+			if(o.n == 0)
+				return;
+
+			init(s);
+			while(s.levels.size() < o.levels.size())
+				s.levels.emplace_back();
+			s.capacity = total_capacity(s.levels.size());
+
+			for(size_t h = 0; h < o.levels.size(); ++h)
+				s.levels[h].insert(end(s.levels[h]),
+					begin(o.levels[h]), end(o.levels[h]));
+			s.size += o.size;
+			s.n += o.n;
+
+			while(s.size > s.capacity)
+				compact(s);
+		}
+
+		double value(quantile_state const& s) const {
+			if(s.n == 0)
+				return numeric_limits<double>::quiet_NaN();
+
+			vector<pair<double, uint64_t>> items;
+			for(size_t h = 0; h < s.levels.size(); ++h)
+				for(double v : s.levels[h])
+					items.emplace_back(v, uint64_t(1) << h);
+			sort(begin(items), end(items));
+
+			// The first item at which the cumulative weight reaches the
+			// requested rank.
+			double rank = _p * double(s.n);
+			uint64_t weight = 0;
+			for(auto const& item : items) {
+				weight += item.second;
+				if(double(weight) >= rank)
+					return item.first;
+			}
+			return items.back().first;
+		}
+
+		size_t heap_memory(quantile_state const& s) const {
+			size_t result = s.levels.capacity() * sizeof(vector<double>);
+			for(auto const& level : s.levels)
+				result += level.capacity() * sizeof(double);
+			return result;
+		}
+	};
+
+	// The state of the exact quantile. The values that don't fit in the
+	// memory budget are kept in the sorted runs in the extents of the shared
+	// temporary file. The runs never change once written, so the copies of
+	// a state share them.
+	struct exact_quantile_state {
+		mutable vector<double> values;	// Reordered by the queries.
+		vector<shared_ptr<spill::extent>> runs;
+		uint64_t n;
+	};
+
+	// Computes a quantile of the values exactly, i.e. the smallest value
+	// for which at least the given fraction of the values is less or equal.
+	// The values are buffered in the memory and the quantile is selected
+	// with nth_element(). When the buffer reaches the memory budget it is
+	// sorted and spilled to a temporary file, in which case the quantile is
+	// found by merging the runs and the buffer until the requested rank.
+	// Once there are too many runs the smallest ones are merged together,
+	// so that a query merges a bounded number of them. All the runs of all
+	// the states share one file, so their number isn't limited by the open
+	// files. The budget applies to each state separately, e.g. to each group
+	// of the groupby. The NaN values are ignored.
+	class exact_quantile : public basic<exact_quantile, exact_quantile_state> {
+		static const size_t MAX_RUNS = 16;
+		static const size_t MERGED_RUNS = 8;
+
+		double _p;
+		size_t _limit;		// The number of the values kept in memory.
+
+		// Calls f with the values of all the runs and the sorted buffer in
+		// the ascending order, as long as it returns true.
+		template<class F>
+		static void merge_runs(exact_quantile_state const& s, F f) {
+			vector<spill::reader<double, spill::extent>> readers;
+			for(auto const& run : s.runs)
+				readers.emplace_back(*run);
+
+			// The current value of each run, the buffer being the last one.
+			typedef pair<double, size_t> head;
+			priority_queue<head, vector<head>, greater<head>> heads;
+			double value;
+			for(size_t i = 0; i < readers.size(); ++i)
+				if(readers[i].next(value))
+					heads.emplace(value, i);
+			size_t pos = 0;
+			if(pos < s.values.size())
+				heads.emplace(s.values[pos++], readers.size());
+
+			while(!heads.empty()) {
+				head top = heads.top();
+				heads.pop();
+				if(!f(top.first))
+					return;
+				if(top.second < readers.size()) {
+					if(readers[top.second].next(value))
+						heads.emplace(value, top.second);
+				} else if(pos < s.values.size()) {
+					heads.emplace(s.values[pos++], top.second);
+				}
+			}
+		}
+
+		// Writes the buffer to a new run.
+		static void spill_values(exact_quantile_state& s) {
+			sort(begin(s.values), end(s.values));
+			shared_ptr<spill::extent> run(
+				new spill::extent(s.values.size() * sizeof(double)));
+			run->write(s.values.data(), s.values.size() * sizeof(double));
+			s.values.clear();
+			s.runs.push_back(run);
+		}
+
+		// Replaces the smallest runs with a single one. The runs are merged
+		// in tiers, so that each value is rewritten only a logarithmic
+		// number of times.
+		static void merge_small_runs(exact_quantile_state& s) {
+			typedef shared_ptr<spill::extent> run_ptr;
+			sort(begin(s.runs), end(s.runs), [](run_ptr const& a, run_ptr const& b) {
+				return a->size() > b->size();
+			});
+
+			size_t first = s.runs.size() - MERGED_RUNS;
+			exact_quantile_state small = {
+				{}, vector<run_ptr>(begin(s.runs) + first, end(s.runs)), 0 };
+			uint64_t size = 0;
+			for(size_t i = first; i < s.runs.size(); ++i)
+				size += s.runs[i]->size();
+			run_ptr merged(new spill::extent(size));
+			vector<double> block;
+			block.reserve(8192);
+			merge_runs(small, [&](double value) {
+				block.push_back(value);
+				if(block.size() == block.capacity()) {
+					merged->write(block.data(), block.size() * sizeof(double));
+					block.clear();
+				}
+				return true;
+			});
+			merged->write(block.data(), block.size() * sizeof(double));
+
+			s.runs.resize(first);
+			s.runs.push_back(merged);
+		}
+
+	public:
+		exact_quantile(double p, size_t budget) :
+				_p(p), _limit(budget / sizeof(double)) {
+			if(!(p >= 0.0 && p <= 1.0))
+				throw string("The quantile must be between 0 and 1.");
+			if(budget < 1024)
+				throw string("The exact quantile memory budget must be at least 1 kB.");
+		}
+
+		static exact_quantile_state initial() {
+			return { {}, {}, 0 };
+		}
+
+		void update(exact_quantile_state& s, double value) const {
+			if(value != value)
+				return;
+
+			if(s.values.size() == s.values.capacity()) {
+				if(s.values.size() >= _limit) {
+					spill_values(s);
+					if(s.runs.size() > MAX_RUNS)
+						merge_small_runs(s);
+				} else {
+					size_t grown = 2 * s.values.capacity();
+					s.values.reserve(grown < 16 ? 16 : grown > _limit ? _limit : grown);
+				}
+			}
+			s.values.push_back(value);
+			++s.n;
+		}
+
+		void combine(exact_quantile_state& s, exact_quantile_state const& o) const {
+			uint64_t n = s.n + o.n;
+			s.runs.insert(end(s.runs), begin(o.runs), end(o.runs));
+			while(s.runs.size() > MAX_RUNS)
+				merge_small_runs(s);
+			for(double value : o.values)
+				update(s, value);
+			s.n = n;
+		}
+
+		double value(exact_quantile_state const& s) const {
+			if(s.n == 0)
+				return numeric_limits<double>::quiet_NaN();
+
+			// The zero based index of the smallest value with at least the
+			// fraction p of the values at or before it.
+			double rank = ceil(_p * double(s.n));
+			uint64_t index = rank < 1.0 ? 0 : uint64_t(rank) - 1;
+			if(index >= s.n)
+				index = s.n - 1;
+
+			if(s.runs.empty()) {
+				nth_element(begin(s.values), begin(s.values) + index, end(s.values));
+				return s.values[index];
+			}
+
+			sort(begin(s.values), end(s.values));
+			double result = 0.0;
+			uint64_t seen = 0;
+			merge_runs(s, [&](double value) {
+				result = value;
+				return seen++ < index;
+			});
+			return result;
+		}
+
+		size_t heap_memory(exact_quantile_state const& s) const {
+			return s.values.capacity() * sizeof(double) +
+				s.runs.capacity() * sizeof(shared_ptr<spill::extent>);
+		}
+	};
+
+	// Estimates the number of the distinct values with the HyperLogLog
+	// algorithm (Flajolet, Fusy, Gandouet and Meunier). The hash of each
+	// value selects one of the 2^p registers by its highest p bits and the
+	// register keeps the maximum position of the first set bit in the rest
+	// of the hash. The estimate is a harmonic mean over the registers, with
+	// the linear counting of the empty registers for the small counts. The
+	// standard error is about 1.04 / sqrt(2^p), i.e. 1.6% for the default
+	// p = 12, with one byte per register allocated by the first value. The
+	// sketches are merged by the maximum of the registers.
+	//
+	// The aggregator takes text, so that e.g. the identifiers are counted as
+	// written. The numbers are counted by their values, so 1 and 1.0 are the
+	// same number, but different texts. The NaN values are ignored.
+	class distinct : public basic<distinct, vector<uint8_t>> {
+		uint32_t _p;
+
+		// Finalizes a hash so that all its bits depend on all the input.
+		static uint64_t mix(uint64_t hash) {
+			hash ^= hash >> 33;
+			hash *= 0xff51afd7ed558ccdULL;
+			hash ^= hash >> 33;
+			hash *= 0xc4ceb9fe1a85ec53ULL;
+			hash ^= hash >> 33;
+			return hash;
+		}
+
+		void insert(vector<uint8_t>& registers, uint64_t hash) const {
+			if(registers.empty())
+				registers.assign(size_t(1) << _p, 0);
+
+			uint64_t rest = (hash << _p) | (uint64_t(1) << (_p - 1));
+			uint8_t rank = __builtin_clzll(rest) + 1;
+			uint8_t& reg = registers[hash >> (64 - _p)];
+			if(reg < rank)
+				reg = rank;
+		}
+
+	public:
+		explicit distinct(uint32_t p) : _p(p) {
+			if(p < 4 || p > 18)
+				throw string("The distinct precision must be between 4 and 18.");
+		}
+
+		bool takes_text() const {
+			return true;
+		}
+
+		static vector<uint8_t> initial() {
+			return {};
+		}
+
+		void update(vector<uint8_t>& registers, double value) const {
+			if(value != value)
+				return;
+			if(value == 0.0)
+				value = 0.0;
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			insert(registers, mix(bits));
+		}
+
+		void update_text(vector<uint8_t>& registers,
+				char const* data, size_t size) const {
+			insert(registers, mix(input::hash_bytes(data, size)));
+		}
+
+		void combine(vector<uint8_t>& registers,
+				vector<uint8_t> const& other) const {
+			if(other.empty())
+				return;
+			if(registers.empty()) {
+				registers = other;
+				return;
+			}
+			for(size_t i = 0; i < registers.size(); ++i)
+				if(registers[i] < other[i])
+					registers[i] = other[i];
+		}
+
+		double value(vector<uint8_t> const& registers) const {
+			if(registers.empty())
+				return 0.0;
+
+			double m = double(registers.size());
+			double sum = 0.0;
+			uint32_t zeros = 0;
+			for(uint8_t reg : registers) {
+				sum += ldexp(1.0, -int(reg));
+				if(reg == 0)
+					++zeros;
+			}
+
+			double alpha = _p == 4 ? 0.673 : _p == 5 ? 0.697 : _p == 6 ? 0.709 :
+				0.7213 / (1.0 + 1.079 / m);
+			double estimate = alpha * m * m / sum;
+			if(estimate <= 2.5 * m && zeros > 0)
+				estimate = m * log(m / zeros);
+			return floor(estimate + 0.5);
+		}
+
+		size_t heap_memory(vector<uint8_t> const& registers) const {
+			return registers.capacity();
+		}
 	};
 
 	// The function takes a so called constructor string as an argument,
@@ -196,6 +1301,63 @@ namespace aggr {
 			return unique_ptr<aggregator>(new ci_gauss(conf_lvl));
 		}
 
+		// Approximate quantile aggregator with an optional sketch size.
+		sregex quant_re = "quantile" >> +_s >> (s1 = +_d >> !('.' >> *_d)) >>
+			!(+_s >> (s2 = +_d)) >> *_s;
+		if(regex_match(str, match, quant_re)) {
+
+			double p;
+			uint32_t k = 200;
+
+			stringstream ss;
+			ss << match[1];
+			ss >> p;
+
+			if(match[2].matched) {
+				stringstream kss;
+				kss << match[2];
+				kss >> k;
+			}
+
+			return unique_ptr<aggregator>(new quantile(p, k));
+		}
+
+		// Distinct count aggregator with an optional precision.
+		sregex distinct_re = "distinct" >> !(+_s >> (s1 = +_d)) >> *_s;
+		if(regex_match(str, match, distinct_re)) {
+
+			uint32_t p = 12;
+
+			if(match[1].matched) {
+				stringstream ss;
+				ss << match[1];
+				ss >> p;
+			}
+
+			return unique_ptr<aggregator>(new distinct(p));
+		}
+
+		// Exact quantile aggregator with an optional memory budget in MB.
+		sregex exact_re = "exact_quantile" >> +_s >> (s1 = +_d >> !('.' >> *_d)) >>
+			!(+_s >> (s2 = +_d >> !('.' >> *_d))) >> *_s;
+		if(regex_match(str, match, exact_re)) {
+
+			double p;
+			double budget = 64.0;
+
+			stringstream ss;
+			ss << match[1];
+			ss >> p;
+
+			if(match[2].matched) {
+				stringstream bss;
+				bss << match[2];
+				bss >> budget;
+			}
+
+			return unique_ptr<aggregator>(new exact_quantile(p, size_t(budget * 1048576.0)));
+		}
+
 		// No case satisfied. Abort.
 		// -------------------------
 		throw string("Failed recognizing aggregator in : \"" + str + "\".");
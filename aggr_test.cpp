@@ -21,6 +21,8 @@
 #include <vector>
 using std::vector;
 
+#include <sys/resource.h>
+
 #include <unittest++/UnitTest++.h>
 using namespace UnitTest;
 
@@ -109,6 +111,315 @@ TEST(string_based_construction_test) {
 	CHECK(dynamic_cast<aggr::ci_gauss*>(ptr.get()));
 }
 
+TEST(clone_test) {
+
+	aggr::sum sum_aggregator;
+	sum_aggregator.put(ANY_DOUBLE);
+
+	aggr::ptr copy = sum_aggregator.clone();
+	CHECK(dynamic_cast<aggr::sum*>(copy.get()));
+	CHECK_CLOSE(ANY_DOUBLE, copy->get(), TOLERANCE);
+
+	copy->put(ANY_DOUBLE);
+	CHECK_CLOSE(ANY_DOUBLE, sum_aggregator.get(), TOLERANCE);
+	CHECK_CLOSE(2.0 * ANY_DOUBLE, copy->get(), TOLERANCE);
+}
+
+TEST(merge_test) {
+
+	vector<double> left { 2.0, 4.0, 4.0 };
+	vector<double> right { 4.0, 5.0, 5.0, 7.0, 9.0 };
+
+	vector<string> constrs { "count", "min", "max", "sum", "mean", "stdev",
+		"ci_gauss 0.95" };
+
+	for(string const& constr : constrs) {
+		aggr::ptr whole = aggr::create_from_string(constr);
+		aggr::ptr lhs = aggr::create_from_string(constr);
+		aggr::ptr rhs = aggr::create_from_string(constr);
+
+		for(double e : left) {
+			whole->put(e);
+			lhs->put(e);
+		}
+
+		for(double e : right) {
+			whole->put(e);
+			rhs->put(e);
+		}
+
+		lhs->merge(*rhs);
+		CHECK_CLOSE(whole->get(), lhs->get(), TOLERANCE);
+	}
+}
+
+TEST(merge_empty_test) {
+
+	aggr::stdev empty;
+	aggr::stdev full;
+	for(double e : { 1.0, 2.0, 3.0 })
+		full.put(e);
+
+	aggr::stdev copy = full;
+	copy.merge(empty);
+	CHECK_CLOSE(1.0, copy.get(), TOLERANCE);
+
+	empty.merge(full);
+	CHECK_CLOSE(1.0, empty.get(), TOLERANCE);
+}
+
+TEST(put_batch_test) {
+
+	// An odd size, so that the vectorized loops leave a remainder.
+	vector<double> collection;
+	for(uint32_t i = 0; i < 2051; ++i)
+		collection.push_back(double((i * 7919) % 1000) / 10.0 - 30.0);
+
+	vector<string> constrs { "count", "min", "max", "sum", "mean", "stdev",
+		"ci_gauss 0.95" };
+
+	for(string const& constr : constrs) {
+		aggr::ptr single = aggr::create_from_string(constr);
+		aggr::ptr batch = aggr::create_from_string(constr);
+
+		for(double e : collection)
+			single->put(e);
+
+		batch->put_batch(collection.data(), 1000);
+		batch->put_batch(collection.data() + 1000, collection.size() - 1000);
+
+		CHECK_CLOSE(single->get(), batch->get(), TOLERANCE);
+	}
+}
+
+TEST(put_batch_nan_test) {
+
+	vector<double> collection { 3.0, numeric_limits<double>::quiet_NaN(),
+		1.0, 2.0, numeric_limits<double>::quiet_NaN() };
+
+	aggr::min min_aggregator;
+	min_aggregator.put_batch(collection.data(), collection.size());
+	CHECK_EQUAL(1.0, min_aggregator.get());
+
+	aggr::max max_aggregator;
+	max_aggregator.put_batch(collection.data(), collection.size());
+	CHECK_EQUAL(3.0, max_aggregator.get());
+}
+
+TEST(store_test) {
+
+	// The values are scattered among a few slots of a store and put into
+	// the separate aggregators, the results must be the same.
+	uint32_t num_slots = 3;
+	vector<double> collection;
+	vector<uint32_t> slots;
+	for(uint32_t i = 0; i < 100; ++i) {
+		collection.push_back(double((i * 7919) % 1000) / 10.0 - 30.0);
+		slots.push_back(i % num_slots);
+	}
+
+	vector<string> constrs { "count", "min", "max", "sum", "mean", "stdev",
+		"ci_gauss 0.95" };
+
+	for(string const& constr : constrs) {
+		aggr::ptr prototype = aggr::create_from_string(constr);
+		aggr::store_ptr store = prototype->make_store();
+		aggr::store_ptr other = prototype->make_store();
+		vector<aggr::ptr> singles;
+		for(uint32_t i = 0; i < num_slots; ++i) {
+			singles.push_back(prototype->clone());
+			CHECK_EQUAL(i, store->add());
+			other->add();
+		}
+
+		for(uint32_t i = 0; i < collection.size(); ++i)
+			singles[slots[i]]->put(collection[i]);
+
+		// Half of the values go through another store that is merged.
+		size_t half = collection.size() / 2;
+		store->put_scatter(slots.data(), collection.data(), half);
+		other->put_scatter(slots.data() + half, collection.data() + half,
+				collection.size() - half);
+		for(uint32_t i = 0; i < num_slots; ++i)
+			store->merge(i, *other, i);
+
+		for(uint32_t i = 0; i < num_slots; ++i)
+			CHECK_CLOSE(singles[i]->get(), store->get(i), TOLERANCE);
+	}
+}
+
+TEST(quantile_test) {
+
+	// A permutation of the numbers 0 .. size - 1, so that the exact
+	// quantile p is p * size.
+	uint32_t size = 100000;
+	vector<double> collection;
+	for(uint32_t i = 0; i < size; ++i)
+		collection.push_back(double((uint64_t(i) * 7919) % size));
+
+	// The rank error bound for the default sketch size.
+	double max_error = 0.017 * size;
+
+	vector<double> ps { 0.01, 0.25, 0.5, 0.9, 0.99 };
+	for(double p : ps) {
+		stringstream constr;
+		constr << "quantile " << p;
+
+		aggr::ptr whole = aggr::create_from_string(constr.str());
+		aggr::ptr first = aggr::create_from_string(constr.str());
+		aggr::ptr second = aggr::create_from_string(constr.str());
+		for(uint32_t i = 0; i < size; ++i) {
+			whole->put(collection[i]);
+			(i < size / 3 ? first : second)->put(collection[i]);
+		}
+		first->merge(*second);
+
+		CHECK_CLOSE(p * size, whole->get(), max_error);
+		CHECK_CLOSE(p * size, first->get(), max_error);
+	}
+
+	// The memory is bounded regardless of the number of the values: about
+	// 3k items, with the slack of the growing vectors.
+	aggr::ptr prototype = aggr::create_from_string("quantile 0.5");
+	aggr::store_ptr store = prototype->make_store();
+	store->add();
+	for(uint32_t i = 0; i < size; ++i)
+		store->put(0, collection[i]);
+	CHECK(store->memory() < 4 * 3 * 200 * sizeof(double));
+
+	CHECK_THROW(aggr::create_from_string("quantile 2"), string);
+}
+
+TEST(exact_quantile_test) {
+
+	// A permutation of the numbers 1 .. size, so that the exact quantile p
+	// is the p * size rounded up.
+	uint32_t size = 100000;
+	vector<double> collection;
+	for(uint32_t i = 0; i < size; ++i)
+		collection.push_back(double((uint64_t(i) * 7919) % size + 1));
+
+	vector<double> ps { 0.0, 0.01, 0.25, 0.5, 0.9, 0.99, 1.0 };
+	for(double p : ps) {
+		double expected = ceil(p * size);
+		if(expected < 1.0)
+			expected = 1.0;
+
+		// In memory.
+		aggr::exact_quantile memory(p, 1 << 20);
+		for(double value : collection)
+			memory.put(value);
+		CHECK_EQUAL(expected, memory.get());
+
+		// With a budget of a thousand values, so that the values are
+		// spilled to many runs which are merged on the way.
+		aggr::exact_quantile whole(p, 8192);
+		aggr::exact_quantile first(p, 8192);
+		aggr::exact_quantile second(p, 8192);
+		for(uint32_t i = 0; i < size; ++i) {
+			whole.put(collection[i]);
+			(i < size / 3 ? first : second).put(collection[i]);
+		}
+		first.merge(second);
+		CHECK_EQUAL(expected, whole.get());
+		CHECK_EQUAL(expected, first.get());
+
+		// The state in memory stays within the budget.
+		aggr::store_ptr store = whole.make_store();
+		store->add();
+		for(double value : collection)
+			store->put(0, value);
+		CHECK_EQUAL(expected, store->get(0));
+		CHECK(store->memory() < 2 * 8192);
+	}
+
+	aggr::ptr ignoring_nan = aggr::create_from_string("exact_quantile 0.5 0.01");
+	ignoring_nan->put(1.0);
+	ignoring_nan->put(numeric_limits<double>::quiet_NaN());
+	ignoring_nan->put(3.0);
+	CHECK_EQUAL(1.0, ignoring_nan->get());
+
+	CHECK_THROW(aggr::create_from_string("exact_quantile 2"), string);
+	CHECK_THROW(aggr::create_from_string("exact_quantile 0.5 0"), string);
+}
+
+TEST(exact_quantile_many_states_test) {
+
+	// Far more spilled runs than the open files allowed, as the runs of
+	// all the states share one file.
+	rlimit original;
+	getrlimit(RLIMIT_NOFILE, &original);
+	rlimit lowered = original;
+	lowered.rlim_cur = 64;
+	setrlimit(RLIMIT_NOFILE, &lowered);
+
+	uint32_t states = 1000;
+	uint32_t size = 1000;
+	aggr::exact_quantile median(0.5, 1024);
+	aggr::store_ptr store = median.make_store();
+	for(uint32_t i = 0; i < states; ++i)
+		store->add();
+	for(uint32_t j = 0; j < size; ++j)
+		for(uint32_t i = 0; i < states; ++i)
+			store->put(i, double((uint64_t(j) * 7919) % size + 1 + i));
+
+	uint32_t wrong = 0;
+	for(uint32_t i = 0; i < states; ++i)
+		if(store->get(i) != double(size / 2 + i))
+			++wrong;
+
+	setrlimit(RLIMIT_NOFILE, &original);
+	CHECK_EQUAL(0u, wrong);
+}
+
+TEST(distinct_test) {
+
+	// The small counts are exact thanks to the linear counting.
+	aggr::ptr small = aggr::create_from_string("distinct");
+	for(uint32_t i = 0; i < 1000; ++i) {
+		string id = "subject-" + std::to_string(i % 10);
+		small->put_text(id.data(), id.size());
+	}
+	CHECK_EQUAL(10.0, small->get());
+
+	// The numbers are counted by their values.
+	aggr::ptr numbers = aggr::create_from_string("distinct");
+	numbers->put(1.0);
+	numbers->put(-0.0);
+	numbers->put(0.0);
+	numbers->put(1.0);
+	numbers->put(numeric_limits<double>::quiet_NaN());
+	CHECK_EQUAL(2.0, numbers->get());
+
+	// The large counts are within a few standard errors, also when merged.
+	uint32_t size = 200000;
+	aggr::ptr whole = aggr::create_from_string("distinct 12");
+	aggr::ptr first = aggr::create_from_string("distinct 12");
+	aggr::ptr second = aggr::create_from_string("distinct 12");
+	for(uint32_t i = 0; i < size; ++i) {
+		string id = "trial-" + std::to_string(i);
+		whole->put_text(id.data(), id.size());
+		(i % 3 ? first : second)->put_text(id.data(), id.size());
+		second->put_text(id.data(), id.size());
+	}
+	first->merge(*second);
+
+	double max_error = 4 * 1.04 / 64 * size;
+	CHECK_CLOSE(double(size), whole->get(), max_error);
+	CHECK_EQUAL(whole->get(), first->get());
+
+	// The memory is fixed by the precision.
+	aggr::store_ptr store = whole->make_store();
+	store->add();
+	for(uint32_t i = 0; i < size; ++i)
+		store->put(0, double(i));
+	CHECK_EQUAL(4096u + sizeof(vector<uint8_t>), store->memory());
+
+	CHECK(!aggr::create_from_string("sum")->takes_text());
+	CHECK_THROW(aggr::create_from_string("sum")->put_text("1", 1), string);
+	CHECK_THROW(aggr::create_from_string("distinct 20"), string);
+}
+
 int main() {
 	return RunAllTests();
 }
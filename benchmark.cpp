@@ -0,0 +1,560 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <cstdio>
+using std::printf;
+using std::snprintf;
+using std::fopen;
+using std::fclose;
+using std::fwrite;
+using std::fflush;
+using std::FILE;
+
+#include <cstdlib>
+using std::getenv;
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+#include <sstream>
+using std::stringstream;
+
+#include <string>
+using std::string;
+using std::to_string;
+
+#include <vector>
+using std::vector;
+
+#include <random>
+using std::mt19937_64;
+using std::uniform_real_distribution;
+using std::uniform_int_distribution;
+using std::normal_distribution;
+using std::exponential_distribution;
+
+#include <chrono>
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "aggr.h"
+#include "histogram.h"
+#include "input.h"
+#include "groupby.h"
+
+// The input arguments analysis.
+// =============================
+
+/// The configuration of the benchmark and of the synthetic data.
+struct arguments {
+
+	/// The number of the generated rows - default: 1000000.
+	uint64_t rows;
+
+	/// The number of the key columns - default: 2.
+	uint32_t keys;
+
+	/// The number of the value columns - default: 2.
+	uint32_t columns;
+
+	/// The number of the distinct values in each key column - default: 100.
+	uint32_t cardinality;
+
+	/// The distribution of the values: uniform, normal or exponential
+	/// - default: uniform.
+	string distribution;
+
+	/// The seed of the random number generator - default: 1.
+	uint32_t seed;
+
+	/// The directory of the tested programs - default: the current one.
+	string bin_dir;
+
+	/// Only print the generated data to the standard output.
+	bool generate_only;
+
+	/// Which of the benchmark groups to run - default: both.
+	bool micro;
+	bool end_to_end;
+};
+
+/// Parses an unsigned number argument of an option.
+template<class T>
+T parse_number(char const* str, char option) {
+	stringstream converter;
+	T result;
+	converter << str;
+	converter >> result;
+	if(converter.fail())
+		throw string("Failed parsing the argument of the option -") + option + ".";
+	return result;
+}
+
+/// Parses the program arguments building a proper object that reflects them.
+arguments parse_args(int argc, char** argv) {
+
+	arguments args;
+	args.rows = 1000000;
+	args.keys = 2;
+	args.columns = 2;
+	args.cardinality = 100;
+	args.distribution = "uniform";
+	args.seed = 1;
+	args.bin_dir = ".";
+	args.generate_only = false;
+	args.micro = true;
+	args.end_to_end = true;
+
+	int c;
+	while((c = getopt(argc, argv, "r:g:c:k:d:s:b:GME")) != -1) {
+		switch(c) {
+		case 'r':
+			args.rows = parse_number<uint64_t>(optarg, c);
+			break;
+
+		case 'g':
+			args.keys = parse_number<uint32_t>(optarg, c);
+			break;
+
+		case 'c':
+			args.columns = parse_number<uint32_t>(optarg, c);
+			break;
+
+		case 'k':
+			args.cardinality = parse_number<uint32_t>(optarg, c);
+			break;
+
+		case 'd':
+			args.distribution = optarg;
+			if(args.distribution != "uniform" &&
+					args.distribution != "normal" &&
+					args.distribution != "exponential")
+				throw string("Unknown distribution \"") + optarg + "\".";
+			break;
+
+		case 's':
+			args.seed = parse_number<uint32_t>(optarg, c);
+			break;
+
+		case 'b':
+			args.bin_dir = optarg;
+			break;
+
+		case 'G':
+			args.generate_only = true;
+			break;
+
+		case 'M':
+			args.end_to_end = false;
+			break;
+
+		case 'E':
+			args.micro = false;
+			break;
+
+		case '?':
+			throw string("Illegal option or missing argument -") + (char)optopt + ".";
+
+		default:
+			throw string("Illegal option -") + (char)optopt + ".";
+		}
+	}
+
+	if(args.rows == 0 || args.keys == 0 || args.columns == 0 || args.cardinality == 0)
+		throw string("The numbers of the rows, the keys, the columns and the key values must be positive.");
+
+	return args;
+}
+
+// The synthetic data.
+// ===================
+
+/// Generates the rows of the integer keys followed by the values.
+class generator {
+	arguments const& _args;
+	mt19937_64 _engine;
+	uniform_int_distribution<uint32_t> _key;
+	uniform_real_distribution<double> _uniform;
+	normal_distribution<double> _normal;
+	exponential_distribution<double> _exponential;
+
+public:
+	generator(arguments const& args)
+	: _args(args)
+	, _engine(args.seed)
+	, _key(0, args.cardinality - 1)
+	, _uniform(0.0, 100.0)
+	, _normal(50.0, 15.0)
+	, _exponential(0.1)
+	{}
+
+	double value() {
+		if(_args.distribution == "normal")
+			return _normal(_engine);
+		if(_args.distribution == "exponential")
+			return _exponential(_engine);
+		return _uniform(_engine);
+	}
+
+	/// Appends a generated row to the buffer, with a line break. If the
+	/// values buffer is given the first value is also appended to it.
+	void row(string& buffer, string* values) {
+		char field[32];
+		for(uint32_t i = 0; i < _args.keys; ++i) {
+			snprintf(field, sizeof(field), "%u\t", _key(_engine));
+			buffer += field;
+		}
+		for(uint32_t i = 0; i < _args.columns; ++i) {
+			snprintf(field, sizeof(field), "%.4f", value());
+			buffer += field;
+			buffer += i + 1 < _args.columns ? '\t' : '\n';
+			if(i == 0 && values) {
+				*values += field;
+				*values += '\n';
+			}
+		}
+	}
+};
+
+/// Generates the whole data set in memory.
+string generate(arguments const& args) {
+	generator gen(args);
+	string result;
+	for(uint64_t i = 0; i < args.rows; ++i)
+		gen.row(result, 0);
+	return result;
+}
+
+/// Writes a buffer to a file and clears it.
+void write_buffer(string& buffer, FILE* f) {
+	if(fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size())
+		throw string("Failed writing the generated data.");
+	buffer.clear();
+}
+
+/// Generates the data set into a file without keeping it in memory. If the
+/// values file is given, the first value column is also written to it, one
+/// value per line.
+void generate(arguments const& args, FILE* data, FILE* values) {
+	static const size_t BUFFER_SIZE = 1 << 20;
+	generator gen(args);
+	string data_buffer;
+	string values_buffer;
+	for(uint64_t i = 0; i < args.rows; ++i) {
+		gen.row(data_buffer, values ? &values_buffer : 0);
+		if(data_buffer.size() >= BUFFER_SIZE) {
+			write_buffer(data_buffer, data);
+			if(values)
+				write_buffer(values_buffer, values);
+		}
+	}
+	write_buffer(data_buffer, data);
+	if(values)
+		write_buffer(values_buffer, values);
+}
+
+/// Creates a temporary file, returns its path.
+string create_temporary(FILE*& f) {
+	char const* tmp = getenv("TMPDIR");
+	string pattern = string(tmp ? tmp : "/tmp") + "/bench-XXXXXX";
+	vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+
+	int fd = mkstemp(path.data());
+	if(fd < 0)
+		throw string("Failed creating a temporary file.");
+
+	f = fdopen(fd, "w");
+	return path.data();
+}
+
+// The measurements.
+// =================
+
+/// Accumulates the results of the benchmarked operations, so that the
+/// compiler cannot skip computing them.
+volatile double sink;
+
+/// Gets the peak resident set size of this process in kilobytes.
+long self_peak_rss() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/// Prints a result line. The items are the rows, the values or the calls,
+/// depending on the benchmark.
+void report(string const& name, uint64_t items, double seconds, long peak_rss_kb) {
+	// Guard against the zero time of the trivial operations.
+	if(seconds < 1e-9)
+		seconds = 1e-9;
+
+	printf("%s\t%llu\t%.6f\t%.0f\t%.2f\t%ld\n",
+		name.c_str(),
+		(unsigned long long)items,
+		seconds,
+		items / seconds,
+		seconds * 1e9 / items,
+		peak_rss_kb);
+	fflush(stdout);
+}
+
+/// Measures the time of a function processing a given number of items.
+/// The peak RSS of the process is cumulative, so for the microbenchmarks
+/// it is only an upper bound of the memory needed by a single one.
+template<class F>
+void measure(string const& name, uint64_t items, F f) {
+	auto start = steady_clock::now();
+	f();
+	duration<double> elapsed = steady_clock::now() - start;
+	report(name, items, elapsed.count(), self_peak_rss());
+}
+
+// The microbenchmarks.
+// ====================
+
+void bench_aggr(vector<double> const& values) {
+	static const size_t BATCH_SIZE = 4096;
+	vector<string> constrs { "count", "min", "max", "sum", "mean", "stdev",
+		"ci_gauss 0.95" };
+
+	for(string const& constr : constrs) {
+		string name = constr.substr(0, constr.find(' '));
+
+		aggr::ptr single = aggr::create_from_string(constr);
+		measure("aggr::" + name + "::put", values.size(), [&]() {
+			for(double v : values)
+				single->put(v);
+			sink = single->get();
+		});
+
+		aggr::ptr batch = aggr::create_from_string(constr);
+		measure("aggr::" + name + "::put_batch", values.size(), [&]() {
+			for(size_t i = 0; i < values.size(); i += BATCH_SIZE) {
+				size_t size = values.size() - i;
+				batch->put_batch(values.data() + i,
+					size < BATCH_SIZE ? size : BATCH_SIZE);
+			}
+			sink = batch->get();
+		});
+	}
+}
+
+void bench_histogram(vector<double> const& values) {
+	static const uint32_t GET_CALLS = 1000;
+
+	hist::histogram h(1.0);
+	measure("hist::histogram::put", values.size(), [&]() {
+		for(double v : values)
+			h.put(v);
+	});
+
+	measure("hist::histogram::get_buckets", GET_CALLS, [&]() {
+		for(uint32_t i = 0; i < GET_CALLS; ++i) {
+			h.put(values[i % values.size()]);
+			sink = h.get_buckets().size();
+		}
+	});
+}
+
+void bench_split(string const& data, uint64_t rows) {
+	vector<string> lines;
+	input::source in(input::field { data.data(), data.size() });
+	input::field line;
+	while(in.next_line(line))
+		lines.push_back(line.str());
+
+	measure("util::split", rows, [&]() {
+		size_t fields = 0;
+		for(string const& l : lines)
+			fields += split(l, '\t').size();
+		sink = fields;
+	});
+
+	measure("input::split", rows, [&]() {
+		size_t fields = 0;
+		input::row row;
+		for(string const& l : lines) {
+			input::split({ l.data(), l.size() }, '\t', row);
+			fields += row.size();
+		}
+		sink = fields;
+	});
+}
+
+void bench_groupper(string const& data, arguments const& args) {
+	vector<input::row> rows;
+	input::source in(input::field { data.data(), data.size() });
+	input::row row;
+	while(in.next_row('\t', row))
+		rows.push_back(row);
+
+	vector<uint32_t> groupbys;
+	for(uint32_t i = 0; i < args.keys; ++i)
+		groupbys.push_back(i);
+
+	vector<string> aggr_strs;
+	for(uint32_t i = 0; i < args.columns; ++i)
+		aggr_strs.push_back(to_string(args.keys + i) + " mean");
+
+	groupby::groupper g(groupbys, aggr_strs);
+	measure("groupby::groupper::consume_row", rows.size(), [&]() {
+		for(input::row const& r : rows)
+			g.consume_row(r);
+		sink = g.copy_result().size();
+	});
+}
+
+// The end to end timings.
+// =======================
+
+/// Runs a program with the standard input read from a given file and the
+/// output discarded, reports its time and peak RSS.
+void run_program(string const& name, uint64_t rows,
+		vector<string> const& command, string const& input_path) {
+
+	vector<char*> argv;
+	for(string const& arg : command)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(0);
+
+	auto start = steady_clock::now();
+
+	pid_t pid = fork();
+	if(pid < 0)
+		throw string("Failed starting a process.");
+
+	if(pid == 0) {
+		int in = open(input_path.c_str(), O_RDONLY);
+		int out = open("/dev/null", O_WRONLY);
+		if(in < 0 || out < 0)
+			_exit(127);
+		dup2(in, 0);
+		dup2(out, 1);
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+
+	int status;
+	struct rusage usage;
+	if(wait4(pid, &status, 0, &usage) != pid)
+		throw string("Failed waiting for a process.");
+
+	duration<double> elapsed = steady_clock::now() - start;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		throw string("The program \"") + command[0] + "\" has failed.";
+
+	report(name, rows, elapsed.count(), usage.ru_maxrss);
+}
+
+/// The data is generated into the files before the programs are run, so
+/// that the benchmark process itself stays small. Its memory would count in
+/// the peak RSS reported for the child processes, which is inherited over
+/// fork() and exec().
+void bench_programs(arguments const& args) {
+	FILE* data;
+	FILE* values;
+	string data_path = create_temporary(data);
+	string values_path = create_temporary(values);
+	string bin = args.bin_dir + "/";
+	string value_field = to_string(args.keys);
+
+	try {
+		generate(args, data, values);
+		if(fclose(data) != 0 || fclose(values) != 0)
+			throw string("Failed writing the generated data.");
+
+		run_program("cli::aggr", args.rows,
+			{ bin + "aggr", "mean" }, values_path);
+
+		run_program("cli::histogram", args.rows,
+			{ bin + "histogram", "-w", "1" }, values_path);
+
+		vector<string> groupby_cmd { bin + "groupby" };
+		vector<string> pivot_cmd { bin + "pivot" };
+		for(uint32_t i = 0; i < args.keys; ++i) {
+			groupby_cmd.push_back("-g" + to_string(i));
+			pivot_cmd.push_back("-D" + to_string(i));
+		}
+		groupby_cmd.insert(groupby_cmd.end(), {
+			"-a", value_field + " mean", "-a", value_field + " stdev" });
+		pivot_cmd.insert(pivot_cmd.end(), { "-a", value_field + " mean" });
+
+		run_program("cli::groupby", args.rows, groupby_cmd, data_path);
+
+		// The pivot table only takes two or three dimensions.
+		if(args.keys == 2 || args.keys == 3)
+			run_program("cli::pivot", args.rows, pivot_cmd, data_path);
+	} catch(...) {
+		unlink(data_path.c_str());
+		unlink(values_path.c_str());
+		throw;
+	}
+
+	unlink(data_path.c_str());
+	unlink(values_path.c_str());
+}
+
+// The main program.
+// =================
+
+int main(int argc, char** argv) {
+	try {
+		arguments args = parse_args(argc, argv);
+
+		if(args.generate_only) {
+			generate(args, stdout, 0);
+			return 0;
+		}
+
+		printf("benchmark\titems\tseconds\titems_per_s\tns_per_item\tpeak_rss_kb\n");
+
+		// The end to end timings go first, while this process is small.
+		if(args.end_to_end)
+			bench_programs(args);
+
+		if(args.micro) {
+			string data = generate(args);
+			vector<double> values;
+			generator gen(args);
+			for(uint64_t i = 0; i < args.rows; ++i)
+				values.push_back(gen.value());
+
+			bench_aggr(values);
+			bench_histogram(values);
+			bench_split(data, args.rows);
+			bench_groupper(data, args);
+		}
+
+		return 0;
+
+	} catch(string const& message) {
+		cout << "Error : " << message << endl;
+		return 1;
+	}
+}
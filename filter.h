@@ -0,0 +1,341 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <cstdint>
+
+#include <cctype>
+using std::isspace;
+
+#include <cstring>
+using std::memcmp;
+using std::strchr;
+using std::strlen;
+
+#include <string>
+using std::string;
+using std::to_string;
+using std::stoul;
+
+#include <utility>
+using std::move;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include "input.h"
+#include "number.h"
+
+namespace filter {
+
+// A condition on the fields of a row. The row must contain all the columns
+// the condition refers to, which may be ensured by splitting the lines with
+// a projection extended by add_columns().
+class condition {
+public:
+	virtual ~condition() {}
+
+	// Tells whether a row satisfies the condition.
+	virtual bool matches(input::row const& row) const = 0;
+
+	// Adds the columns the condition refers to to a projection.
+	virtual void add_columns(input::projection& columns) const = 0;
+};
+
+typedef unique_ptr<condition> condition_ptr;
+
+enum relation {
+	EQUAL,
+	NOT_EQUAL,
+	LESS,
+	LESS_EQUAL,
+	GREATER,
+	GREATER_EQUAL
+};
+
+// Tells whether a result of a comparison, negative, zero or positive,
+// satisfies a relation.
+inline bool satisfies(int order, relation r) {
+	switch(r) {
+	case EQUAL: return order == 0;
+	case NOT_EQUAL: return order != 0;
+	case LESS: return order < 0;
+	case LESS_EQUAL: return order <= 0;
+	case GREATER: return order > 0;
+	case GREATER_EQUAL: return order >= 0;
+	}
+	return false;
+}
+
+// Compares a field to a number. A field that isn't a number, as well as
+// a nan, doesn't satisfy any relation, including the inequality.
+class number_comparison : public condition {
+	uint32_t _column;
+	relation _relation;
+	double _value;
+
+public:
+	number_comparison(uint32_t column, relation r, double value)
+	: _column(column), _relation(r), _value(value) {}
+
+	bool matches(input::row const& row) const {
+		input::field const& f = row[_column];
+		double value;
+		if(!number::parse_double(f.data, f.data + f.size, value) ||
+				value != value || _value != _value)
+			return false;
+		return satisfies(value < _value ? -1 : value > _value ? 1 : 0,
+			_relation);
+	}
+
+	void add_columns(input::projection& columns) const {
+		columns.add(_column);
+	}
+};
+
+// Compares a field to a text, byte by byte.
+class text_comparison : public condition {
+	uint32_t _column;
+	relation _relation;
+	string _value;
+
+public:
+	text_comparison(uint32_t column, relation r, string const& value)
+	: _column(column), _relation(r), _value(value) {}
+
+	bool matches(input::row const& row) const {
+		input::field const& f = row[_column];
+		size_t size = f.size < _value.size() ? f.size : _value.size();
+		int order = memcmp(f.data, _value.data(), size);
+		if(order == 0)
+			order = f.size < _value.size() ? -1 : f.size > _value.size();
+		return satisfies(order, _relation);
+	}
+
+	void add_columns(input::projection& columns) const {
+		columns.add(_column);
+	}
+};
+
+// Holds if all of the conditions do, or if any of them does.
+class junction : public condition {
+	bool _all;
+	vector<condition_ptr> _parts;
+
+public:
+	junction(bool all, vector<condition_ptr> parts)
+	: _all(all), _parts(move(parts)) {}
+
+	bool matches(input::row const& row) const {
+		for(auto const& part : _parts)
+			if(part->matches(row) != _all)
+				return !_all;
+		return _all;
+	}
+
+	void add_columns(input::projection& columns) const {
+		for(auto const& part : _parts)
+			part->add_columns(columns);
+	}
+};
+
+// Compiles the filter expressions of the form:
+//   expression := conjunction ("||" conjunction)*
+//   conjunction := primary ("&&" primary)*
+//   primary := "(" expression ")" | column relation constant
+// where the column is an index of a field, the relation is one of
+// "==" (or "="), "!=", "<", "<=", ">" and ">=", and the constant is either
+// a quoted text or a word, which is compared as a number if it is one and
+// as a text otherwise.
+class parser {
+	enum token_kind { END, WORD, QUOTED, OPEN, CLOSE, AND, OR, RELATION };
+
+	string const& _text;
+	size_t _pos;
+
+	token_kind _kind;
+	string _value;
+	relation _relation;
+
+	void fail(string const& what) const {
+		throw "Failed parsing the filter \"" + _text + "\": " + what + ".";
+	}
+
+	bool starts(char const* s) const {
+		return _text.compare(_pos, strlen(s), s) == 0;
+	}
+
+	// Reads the next token.
+	void next() {
+		while(_pos < _text.size() && isspace((unsigned char)_text[_pos]))
+			++_pos;
+
+		_value.clear();
+		if(_pos == _text.size()) {
+			_kind = END;
+			return;
+		}
+
+		static struct { char const* symbol; token_kind kind; relation r; }
+		const symbols[] = {
+			{ "&&", AND, EQUAL }, { "||", OR, EQUAL },
+			{ "==", RELATION, EQUAL }, { "!=", RELATION, NOT_EQUAL },
+			{ "<=", RELATION, LESS_EQUAL }, { ">=", RELATION, GREATER_EQUAL },
+			{ "=", RELATION, EQUAL }, { "<", RELATION, LESS },
+			{ ">", RELATION, GREATER },
+			{ "(", OPEN, EQUAL }, { ")", CLOSE, EQUAL } };
+		for(auto const& s : symbols)
+			if(starts(s.symbol)) {
+				_kind = s.kind;
+				_relation = s.r;
+				_pos += strlen(s.symbol);
+				return;
+			}
+
+		char c = _text[_pos];
+		if(c == '"' || c == '\'') {
+			size_t end = _text.find(c, _pos + 1);
+			if(end == string::npos)
+				fail("unterminated quotes");
+			_kind = QUOTED;
+			_value = _text.substr(_pos + 1, end - _pos - 1);
+			_pos = end + 1;
+			return;
+		}
+
+		size_t begin = _pos;
+		while(_pos < _text.size() && !isspace((unsigned char)_text[_pos]) &&
+				!strchr("()<>=!&|\"'", _text[_pos]))
+			++_pos;
+		if(_pos == begin)
+			fail(string("unexpected character '") + c + "'");
+		_kind = WORD;
+		_value = _text.substr(begin, _pos - begin);
+	}
+
+	condition_ptr parse_primary() {
+		if(_kind == OPEN) {
+			next();
+			condition_ptr result = parse_expression();
+			if(_kind != CLOSE)
+				fail("missing closing parenthesis");
+			next();
+			return result;
+		}
+
+		if(_kind != WORD || _value.empty() || _value.size() > 9 ||
+				_value.find_first_not_of("0123456789") != string::npos)
+			fail("expected a column index");
+		uint32_t column = stoul(_value);
+		next();
+
+		if(_kind != RELATION)
+			fail("expected a relation after the column " + to_string(column));
+		relation r = _relation;
+		next();
+
+		double number;
+		condition_ptr result;
+		if(_kind == WORD && number::parse_double(_value, number))
+			result.reset(new number_comparison(column, r, number));
+		else if(_kind == WORD || _kind == QUOTED)
+			result.reset(new text_comparison(column, r, _value));
+		else
+			fail("expected a constant after the relation");
+		next();
+		return result;
+	}
+
+	condition_ptr parse_conjunction() {
+		vector<condition_ptr> parts;
+		parts.push_back(parse_primary());
+		while(_kind == AND) {
+			next();
+			parts.push_back(parse_primary());
+		}
+		if(parts.size() == 1)
+			return move(parts[0]);
+		return condition_ptr(new junction(true, move(parts)));
+	}
+
+	condition_ptr parse_expression() {
+		vector<condition_ptr> parts;
+		parts.push_back(parse_conjunction());
+		while(_kind == OR) {
+			next();
+			parts.push_back(parse_conjunction());
+		}
+		if(parts.size() == 1)
+			return move(parts[0]);
+		return condition_ptr(new junction(false, move(parts)));
+	}
+
+public:
+	explicit parser(string const& text) : _text(text), _pos(0) {}
+
+	condition_ptr parse() {
+		next();
+		condition_ptr result = parse_expression();
+		if(_kind != END)
+			fail("unexpected text at " + to_string(_pos));
+		return result;
+	}
+};
+
+// A conjunction of any number of the filter expressions, compiled once and
+// evaluated on the raw fields of the rows. An empty predicate accepts all
+// the rows.
+class predicate {
+	vector<condition_ptr> _conditions;
+
+public:
+	// Compiles another expression that the rows must satisfy.
+	void add(string const& expression) {
+		_conditions.push_back(parser(expression).parse());
+	}
+
+	bool empty() const {
+		return _conditions.empty();
+	}
+
+	// Tells whether a row satisfies all the expressions. The row must
+	// contain the columns added by add_columns().
+	bool matches(input::row const& row) const {
+		for(auto const& c : _conditions)
+			if(!c->matches(row))
+				return false;
+		return true;
+	}
+
+	// Adds the columns the expressions refer to to a projection.
+	void add_columns(input::projection& columns) const {
+		for(auto const& c : _conditions)
+			c->add_columns(columns);
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include <unittest++/UnitTest++.h>
+using namespace UnitTest;
+
+#include "filter.h"
+
+// Tells whether a tab separated line satisfies a filter expression.
+static bool matches(string const& expression, string const& line) {
+	filter::predicate p;
+	p.add(expression);
+	input::projection columns;
+	p.add_columns(columns);
+	input::row row;
+	columns.split({ line.data(), line.size() }, '\t', row);
+	return p.matches(row);
+}
+
+TEST(number_test) {
+	CHECK(matches("1 > 0.5", "a\t0.75"));
+	CHECK(!matches("1 > 0.5", "a\t0.25"));
+	CHECK(matches("1 >= 2", "a\t2.0"));
+	CHECK(matches("1 == 2", "a\t2e0"));
+	CHECK(matches("1 != 2", "a\t3"));
+	CHECK(matches("1 < -1e3", "a\t-1001"));
+	CHECK(matches("1<=1", "a\t1"));
+
+	// A field that isn't a number doesn't satisfy any relation.
+	CHECK(!matches("1 != 2", "a\tx"));
+	CHECK(!matches("1 < 2", "a\tnan"));
+}
+
+TEST(text_test) {
+	CHECK(matches("0 == abc", "abc\t1"));
+	CHECK(!matches("0 == abc", "abcd\t1"));
+	CHECK(matches("0 != 'abc'", "abcd\t1"));
+	CHECK(matches("0 < b", "abc\t1"));
+	CHECK(matches("0 > \"ab\"", "abc\t1"));
+
+	// A quoted constant is a text even if it looks like a number.
+	CHECK(!matches("0 == '1.0'", "1\t1"));
+	CHECK(matches("0 == 1.0", "1\t1"));
+}
+
+TEST(logic_test) {
+	string line = "x\t1\t5";
+	CHECK(matches("0 == x && 1 == 1", line));
+	CHECK(!matches("0 == x && 1 == 2", line));
+	CHECK(matches("0 == y || 2 > 4", line));
+	CHECK(matches("0 == y || 1 == 1 && 2 > 4", line));
+	CHECK(!matches("(0 == y || 1 == 1) && 2 > 5", line));
+
+	// Many expressions must all be satisfied.
+	filter::predicate p;
+	CHECK(p.empty());
+	p.add("1 == 1");
+	p.add("2 < 5");
+	input::row row = { { "x", 1 }, { "1", 1 }, { "5", 1 } };
+	CHECK(!p.matches(row));
+}
+
+TEST(columns_test) {
+	filter::predicate p;
+	p.add("3 > 0 || (1 == a && 7 != b)");
+	input::projection columns;
+	columns.add(2);
+	p.add_columns(columns);
+	CHECK_EQUAL(8u, columns.size());
+}
+
+TEST(syntax_test) {
+	char const* invalid[] = { "", "1", "1 >", "> 1", "x == 1", "1 == 'a",
+		"(1 == 2", "1 == 2)", "1 == 2 &&", "1 == 2 3 == 4", "1 ~ 2" };
+	for(char const* e : invalid) {
+		filter::predicate p;
+		CHECK_THROW(p.add(e), string);
+	}
+}
+
+int main() {
+	return RunAllTests();
+}
@@ -19,10 +19,7 @@
  */
 
 #include <iostream>
-using std::istream;
-using std::ostream;
 using std::cout;
-using std::cin;
 using std::endl;
 
 #include <string>
@@ -38,10 +35,16 @@ using std::move;
 #include <map>
 using std::map;
 
+#include <limits>
+using std::numeric_limits;
+
 #include <unistd.h>
+#include <getopt.h>
 
-#include "util.h"
+#include "filter.h"
+#include "input.h"
 #include "groupby.h"
+#include "output.h"
 
 // The input arguments analysis.
 // =============================
@@ -58,6 +61,40 @@ struct arguments {
 	/// The aggregator definitions. Format:
 	/// [(field_index, aggregator)]
 	vector<string> aggr_strs;
+
+	/// The input file path - default: empty, meaning the standard input.
+	string input_path;
+
+	/// The number of the processing threads - default: 1.
+	uint32_t threads;
+
+	/// The memory budget of the groups in bytes, above which the rows
+	/// are spilled to the disk - default: 0, meaning no limit.
+	size_t max_memory;
+
+	/// The number of the heaviest groups to report - default: 0, meaning
+	/// all the groups.
+	uint32_t top;
+
+	/// The field whose sum weights the groups for the top groups - default:
+	/// none, meaning the groups are weighted by the count of the rows.
+	uint32_t weight_field;
+
+	/// Whether the input is sorted by the groupping fields, so that each
+	/// group is printed as soon as it ends - default: false.
+	bool sorted;
+
+	/// The filter of the rows to be groupped - default: accepts all.
+	filter::predicate filter;
+};
+
+/// The long aliases of the options.
+const option long_options[] = {
+	{ "max-mem", required_argument, 0, 'm' },
+	{ "sorted", no_argument, 0, 's' },
+	{ "top", required_argument, 0, 't' },
+	{ "weight", required_argument, 0, 'w' },
+	{ 0, 0, 0, 0 }
 };
 
 /// Parses the program arguments building a proper object that reflects them.
@@ -65,11 +102,17 @@ arguments parse_args(int argc, char** argv) {
 
 	arguments args;
 	args.delim = '\t'; // Providing the default delimiter.
+	args.threads = 1;
+	args.max_memory = 0;
+	args.top = 0;
+	args.sorted = false;
+	args.weight_field = groupby::top_groupper::BY_COUNT;
 	stringstream converter;
 	uint32_t index;
+	double megabytes;
 
 	int c;
-	while((c = getopt(argc, argv, "a:d:g:")) != -1) {
+	while((c = getopt_long(argc, argv, "a:d:f:g:j:m:st:w:", long_options, 0)) != -1) {
 		switch(c) {
 		case 'a':
 			args.aggr_strs.emplace_back(optarg);
@@ -86,6 +129,10 @@ arguments parse_args(int argc, char** argv) {
 
 			break;
 
+		case 'f':
+			args.filter.add(optarg);
+			break;
+
 		case 'g':
 			converter.seekg(0);
 			converter.seekp(0);
@@ -96,6 +143,50 @@ arguments parse_args(int argc, char** argv) {
 			args.groupbys.push_back(index);
 			break;
 
+		case 'j': {
+			// A separate converter for the same reason as -m. Read as a
+			// signed number, as a negative one would wrap to a huge count.
+			stringstream threads_converter(optarg);
+			int64_t threads;
+			threads_converter >> threads;
+			if(threads_converter.fail() || threads_converter.peek() != EOF
+				|| threads < 1 || threads > numeric_limits<uint32_t>::max())
+				throw string("Failed parsing the number of threads.");
+			args.threads = uint32_t(threads);
+			break;
+		}
+
+		case 'm': {
+			// A separate converter, as the shared one keeps the rest of
+			// a longer argument.
+			stringstream mem_converter(optarg);
+			mem_converter >> megabytes;
+			if(mem_converter.fail() || !(megabytes > 0))
+				throw string("Failed parsing the memory limit.");
+			args.max_memory = size_t(megabytes * (1 << 20));
+			break;
+		}
+
+		case 's':
+			args.sorted = true;
+			break;
+
+		case 't': {
+			stringstream top_converter(optarg);
+			top_converter >> args.top;
+			if(top_converter.fail() || args.top == 0)
+				throw string("Failed parsing the number of the top groups.");
+			break;
+		}
+
+		case 'w': {
+			stringstream weight_converter(optarg);
+			weight_converter >> args.weight_field;
+			if(weight_converter.fail())
+				throw string("Failed parsing the weight field index.");
+			break;
+		}
+
 		case '?':
 			if(optopt == 'a')
 				throw string("Option -a requires an aggregator argument.");
@@ -103,9 +194,24 @@ arguments parse_args(int argc, char** argv) {
 			if(optopt == 'd')
 				throw string("Option -d requires a delimiter argument.");
 
+			if(optopt == 'f')
+				throw string("Option -f requires a filter expression.");
+
 			if(optopt == 'g')
 				throw string("Option -g requires a groupper argument.");
 
+			if(optopt == 'j')
+				throw string("Option -j requires a number of threads.");
+
+			if(optopt == 'm')
+				throw string("Option -m requires a memory limit.");
+
+			if(optopt == 't')
+				throw string("Option -t requires a number of groups.");
+
+			if(optopt == 'w')
+				throw string("Option -w requires a weight field index.");
+
 			// Notice a fallthrough. It is here although it should
 			// not happen unless someone changes the getopt options definition.
 
@@ -114,27 +220,58 @@ arguments parse_args(int argc, char** argv) {
 		}
 	}
 
+	// An optional input file may follow the options.
+	if(optind < argc - 1)
+		throw string("At most one input file may be given.");
+
+	if(optind < argc)
+		args.input_path = argv[optind];
+
+	if(args.max_memory && args.threads > 1)
+		throw string("The memory limit can't be combined with multiple threads.");
+
+	if(args.top && (args.max_memory || args.threads > 1))
+		throw string("The top groups can't be combined with the memory limit "
+				"or multiple threads.");
+
+	if(args.sorted && (args.top || args.max_memory || args.threads > 1))
+		throw string("The sorted input can't be combined with the top groups, "
+				"the memory limit or multiple threads.");
+
+	if(!args.top && args.weight_field != groupby::top_groupper::BY_COUNT)
+		throw string("The weight field is only used for the top groups.");
+
 	return args;
 }
 
 // The aggregation phase.
 // ======================
 
+/// Feeds the rows of the input that satisfy the filter to a groupper of any
+/// kind, splitting the lines up to the last column used by either of them.
+template<class Groupper>
+void consume_input(input::source& in, input::projection columns,
+		Groupper& groupper, const arguments& args) {
+
+	args.filter.add_columns(columns);
+
+	input::row row;
+	while(in.next_row(args.delim, columns, row))
+		if(args.filter.matches(row))
+			groupper.consume_row(row);
+}
+
 /// Fetches the data from the input stream and finally prints out
 /// the aggregations to the provided output stream.
-groupby::groupper process_stream(istream& in, const arguments& args) {
+groupby::groupper process_stream(input::source& in, const arguments& args) {
 
 	groupby::groupper groupper(args.groupbys, args.aggr_strs);
-	string line;
 
-	while(true) {
-		getline(in, line);
-		if(!in.good())
-			break;
+	if(args.threads > 1)
+		return groupby::consume_parallel(groupper, in.rest(),
+			args.delim, args.threads, args.filter);
 
-		vector<string> row = split(line, args.delim);
-		groupper.consume_row(row);
-	}
+	consume_input(in, groupper.get_projection(), groupper, args);
 
 	return groupper;
 }
@@ -142,14 +279,7 @@ groupby::groupper process_stream(istream& in, const arguments& args) {
 // The result printing phase.
 // ==========================
 
-void print_results(groupby::groupper groupper,
-		ostream& out, 
-		const arguments& args) {
-
-	// Print the groupping report.
-	// ---------------------------
-
-	// Print the header row.
+void print_header(output::writer& out, const arguments& args) {
 	for(uint32_t g : args.groupbys)
 		out << g << args.delim;
 
@@ -159,23 +289,120 @@ void print_results(groupby::groupper groupper,
 			out << args.delim;
 	}
 
-	out << endl;
+	// The weight of the top groups and its error.
+	if(args.top) {
+		out << args.delim << '"';
+		if(args.weight_field == groupby::top_groupper::BY_COUNT)
+			out << "count";
+		else
+			out << args.weight_field << " sum";
+		out << '"' << args.delim << "\"error\"";
+	}
+
+	out << '\n';
+}
+
+void print_results(groupby::groupper groupper,
+		output::writer& out, 
+		const arguments& args) {
+
+	// Print the groupping report.
+	// ---------------------------
+
+	print_header(out, args);
 
 	// Print the groups.
 	groupper.for_each_group([&out,&args](const groupby::group& g) {
-		for(const auto& d : g.get_definition())
-			out << d.second << args.delim;
+		for(uint32_t i = 0; i < g.key_size(); ++i)
+			out << g.get_key_value(i) << args.delim;
 
-		uint32_t aggr_size = g.get_aggregators().size();
+		uint32_t aggr_size = g.size();
 		for(uint32_t i = 0; i < aggr_size; ++i) {
-			out << g.get_aggregators().at(i).second->get();
+			out << g.get_value(i);
 			if(i < (aggr_size - 1))
 				out << args.delim;
 		}
-		out << endl;
+		out << '\n';
 	});
 }
 
+/// Groups the input within the memory limit, spilling to the disk if needed,
+/// and prints the results the same way as print_results() does.
+void process_external(input::source& in, output::writer& out, const arguments& args) {
+
+	groupby::groupper config(args.groupbys, args.aggr_strs);
+	groupby::external_groupper groupper(config, args.max_memory);
+
+	consume_input(in, config.get_projection(), groupper, args);
+
+	print_header(out, args);
+
+	groupper.for_each_result([&out,&args](const vector<string>& key,
+			const vector<double>& values) {
+		for(const string& k : key)
+			out << k << args.delim;
+
+		for(uint32_t i = 0; i < values.size(); ++i) {
+			out << values[i];
+			if(i < (values.size() - 1))
+				out << args.delim;
+		}
+		out << '\n';
+	});
+}
+
+/// Finds the heaviest groups of the input and prints them from the heaviest
+/// one, followed by their weights and the errors of these.
+void process_top(input::source& in, output::writer& out, const arguments& args) {
+
+	groupby::groupper config(args.groupbys, args.aggr_strs);
+	groupby::top_groupper groupper(config, args.top, args.weight_field);
+
+	consume_input(in, groupper.get_projection(), groupper, args);
+
+	print_header(out, args);
+
+	groupper.for_each_result([&out,&args](const vector<string>& key,
+			const vector<double>& values, double weight, double error) {
+		for(const string& k : key)
+			out << k << args.delim;
+
+		for(double value : values)
+			out << value << args.delim;
+
+		out << weight << args.delim << error << '\n';
+	});
+}
+
+/// Groups an input sorted by the groupping fields, printing each group as
+/// soon as it ends. Unless the whole input is at hand the output is flushed
+/// after each group, so that a live stream's results aren't held back.
+void process_sorted(input::source& in, output::writer& out, const arguments& args) {
+
+	print_header(out, args);
+
+	groupby::groupper config(args.groupbys, args.aggr_strs);
+	bool streaming = !in.is_mapped();
+	groupby::sorted_groupper groupper(config, [&out,&args,streaming](
+			const vector<string>& key, const vector<double>& values) {
+		for(const string& k : key)
+			out << k << args.delim;
+
+		for(uint32_t i = 0; i < values.size(); ++i) {
+			out << values[i];
+			if(i < (values.size() - 1))
+				out << args.delim;
+		}
+		out << '\n';
+		if(streaming)
+			out.flush();
+	});
+
+	consume_input(in, config.get_projection(), groupper, args);
+
+	groupper.finish();
+}
+
 int main(int argc, char** argv) {
 
 	// Don't print internal getopt error messages.
@@ -188,11 +415,22 @@ int main(int argc, char** argv) {
 			throw string("Missing groupping or aggregation definitions.");
 
 		// Process the input stream.
-		auto groupper = process_stream(cin, args);
-
-		// Print the results.
-		print_results(move(groupper), cout, args);
-
+		unique_ptr<input::source> in(args.input_path.empty()
+			? new input::source()
+			: new input::source(args.input_path));
+
+		output::writer out;
+
+		if(args.sorted)
+			process_sorted(*in, out, args);
+		else if(args.top)
+			process_top(*in, out, args);
+		else if(args.max_memory)
+			process_external(*in, out, args);
+		else
+			print_results(process_stream(*in, args), out, args);
+
+		out.flush();
 		return 0;
 
 	} catch(string& ex) {
@@ -23,16 +23,41 @@
 
 #include <utility>
 using std::pair;
+using std::move;
+using std::swap;
+
+#include <algorithm>
+using std::equal;
+using std::sort;
 
 #include <vector>
 using std::vector;
 
 #include <string>
 using std::string;
+using std::to_string;
 
 #include <functional>
 using std::function;
 
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
+
+#include <queue>
+using std::priority_queue;
+
+#include <unordered_map>
+using std::unordered_map;
+
+#include <thread>
+using std::thread;
+
+#include <exception>
+using std::exception_ptr;
+using std::current_exception;
+using std::rethrow_exception;
+
 #include <boost/xpressive/xpressive.hpp>
 using boost::xpressive::sregex;
 using boost::xpressive::smatch;
@@ -44,204 +69,1356 @@ using boost::xpressive::_;
 using boost::xpressive::eos;
 
 #include "aggr.h"
+#include "filter.h"
+#include "input.h"
+#include "number.h"
+#include "spill.h"
 
 namespace groupby {
 
-// This class defines a single group of the results.
-// The groups are distinguished by the values of the groupping fields.
-// The data rows from the considered input set may or may not match
-// a given group based on the given groupping fields. Once a matching
-// group is determined, values from the considered row should be put
-// in the group's aggregators.
-class group {
+// The compiled aggregator definition. The prototype aggregator is never
+// fed with any values, it only serves as the template of the stores of the
+// aggregators' states. The store is assigned by the groupper.
+struct aggr_spec {
+	uint32_t field;		// The index of the aggregated field.
+	string constr;		// The aggregator construction string.
+	aggr::ptr prototype;	// The aggregator in its initial state.
+	uint32_t store;		// The index of the store of the states.
+	bool shared;		// Whether the store keeps the shared moments.
+};
+
+// Parses the aggregator definition string of the form: "field constr".
+inline aggr_spec compile_aggr_str(string const& aggr_str) {
+
+	smatch match;
+
+	// Recognize the field to aggregator mapping.
+	sregex base_re = *_s >> (s1 = +_d) >> +_s >> (s2 = +_) >> eos;
+	if(!regex_match(aggr_str, match, base_re))
+		throw string("Unrecognize aggregator string \"") + aggr_str + "\".";
+
+	// Parse the field index.
+	uint32_t field;
+	stringstream field_ss;
+	field_ss << match[1];
+	field_ss >> field;
+
+	if(field_ss.fail())
+		throw string("Failed parsing the field mapping of an aggregator.");
+
+	// Parse the aggregator string.
+	string constr = match.str(2);
+	return { field, constr, aggr::create_from_string(constr), 0, false };
+}
+
+// An open addressing hash table of the ids of the items kept elsewhere, e.g.
+// in a vector. The lookup is given the hash of the item and a function that
+// tells whether the item of a given id is the one looked up.
+class id_index {
+	struct entry {
+		size_t hash;
+		uint32_t id;
+	};
+
+	static const uint32_t EMPTY = 0xffffffff;
+
+	vector<entry> _entries;
+	uint32_t _size;
+
+	void place(entry e) {
+		size_t mask = _entries.size() - 1;
+		size_t i = e.hash & mask;
+		while(_entries[i].id != EMPTY)
+			i = (i + 1) & mask;
+		_entries[i] = e;
+	}
+
+	void grow() {
+		vector<entry> old;
+		old.swap(_entries);
+		_entries.assign(old.empty() ? 16 : 2 * old.size(), entry { 0, EMPTY });
+		for(entry const& e : old)
+			if(e.id != EMPTY)
+				place(e);
+	}
+
+public:
+	id_index() : _size(0) {}
+
+	// Finds the id of the item of a given hash matching the given function.
+	template<class F>
+	bool find(size_t hash, F matches, uint32_t& id) const {
+		if(_entries.empty())
+			return false;
+		size_t mask = _entries.size() - 1;
+		for(size_t i = hash & mask; _entries[i].id != EMPTY; i = (i + 1) & mask)
+			if(_entries[i].hash == hash && matches(_entries[i].id)) {
+				id = _entries[i].id;
+				return true;
+			}
+		return false;
+	}
+
+	// Adds the id of a new item of a given hash.
+	void insert(size_t hash, uint32_t id) {
+		if(2 * (_size + 1) > _entries.size())
+			grow();
+		place({ hash, id });
+		++_size;
+	}
+
+	// Gets the number of the bytes occupied by the table.
+	size_t memory() const {
+		return _entries.capacity() * sizeof(entry);
+	}
+};
+
+// The dictionary of the distinct values of a groupping field. Each value is
+// kept once and the groups refer to it by its id, i.e. its index in the order
+// of the first occurrence. The ids never change, so the groups may compare
+// the ids instead of the values.
+class dictionary {
+	vector<string> _values;
+	id_index _index;
+	size_t _text_size;
+
+public:
+	dictionary() : _text_size(0) {}
+
+	// Finds the id of a given value. Returns false if there's no such value.
+	bool find(input::field value, uint32_t& id) const {
+		size_t hash = input::hash_bytes(value.data, value.size);
+		return _index.find(hash, [this, &value](uint32_t i) {
+			return value == _values[i];
+		}, id);
+	}
+
+	// Gets the id of a given value, adding the value if it's new.
+	uint32_t intern(input::field value) {
+		size_t hash = input::hash_bytes(value.data, value.size);
+		uint32_t id;
+		if(_index.find(hash, [this, &value](uint32_t i) {
+				return value == _values[i];
+			}, id))
+			return id;
+
+		id = _values.size();
+		_values.push_back(value.str());
+		_index.insert(hash, id);
+		_text_size += value.size;
+		return id;
+	}
+
+	// Gets the value of a given id.
+	string const& value(uint32_t id) const {
+		return _values[id];
+	}
 
-	// The field indices and the values that discriminate this
-	// group from the others.
-	vector<pair<uint32_t, string>> _definition;
+	// Gets the number of the distinct values.
+	uint32_t size() const {
+		return _values.size();
+	}
 
-	// The list of the pairs of the indices of the fields to be
-	// aggregated and their respective aggregators.
-	vector<pair<uint32_t, aggr::ptr>> _aggregators;
+	// Estimates the number of the bytes occupied by the values.
+	size_t memory() const {
+		return _values.capacity() * sizeof(string) + _text_size +
+			_index.memory();
+	}
+};
+
+// This class defines a single group of the results.
+// The groups are distinguished by the values of the groupping fields, which
+// the group refers to by their ids in the dictionaries of the groupper.
+// The states of the aggregators aren't stored in the group itself, but in
+// the stores of the groupper at the index of the group.
+// Hence the group is only a lightweight view that is valid for the duration
+// of the iteration over the groups.
+class group {
+	vector<uint32_t> const& _groupbys;
+	vector<dictionary> const& _dictionaries;
+	uint32_t const* _key;
+	vector<aggr_spec> const& _aggr_specs;
+	vector<aggr::store_ptr> const& _stores;
+	uint32_t _slot;
 
 public:
-	// Only allow constructing from the prepared members.
-	group(vector<pair<uint32_t, string>> definition,
-		vector<pair<uint32_t, aggr::ptr>> aggrs)
-	: _definition(definition)
-	, _aggregators(move(aggrs))
+	group(vector<uint32_t> const& groupbys,
+		vector<dictionary> const& dictionaries,
+		uint32_t const* key,
+		vector<aggr_spec> const& aggr_specs,
+		vector<aggr::store_ptr> const& stores,
+		uint32_t slot)
+	: _groupbys(groupbys)
+	, _dictionaries(dictionaries)
+	, _key(key)
+	, _aggr_specs(aggr_specs)
+	, _stores(stores)
+	, _slot(slot)
 	{}
 
-	// Checks whether a given row belongs to this group.
-	bool matches_row(vector<string> const& row) const {
-		for(auto const& def : _definition)
-			if(row.at(def.first) != def.second)
-				return false;
-		
-		return true;
+	// Gets the number of the groupping fields.
+	uint32_t key_size() const {
+		return _groupbys.size();
 	}
 
-	// Getter for the definition.
-	vector<pair<uint32_t, string>> const& get_definition() const {
-		return _definition;
+	// Gets the id of the value of a given groupping field in its dictionary.
+	uint32_t get_key(uint32_t i) const {
+		return _key[i];
 	}
 
-	// Getter for the aggregators.
-	vector<pair<uint32_t, aggr::ptr>> const& get_aggregators() const {
-		return _aggregators;
+	// Gets the value of a given groupping field.
+	string const& get_key_value(uint32_t i) const {
+		return _dictionaries[i].value(_key[i]);
 	}
 
-	// Consumes the row, i.e. feeds all the aggregators with
-	// the values from the respective fields.
-	void consume_row(vector<string> const& row) const {
-		for(auto& aggr : _aggregators) {
-			double value;
-			stringstream ss;
-			ss << row[aggr.first];
-			ss >> value;
-			if(ss.fail()) {
-				stringstream rowss;
-				for(string const& s : row)
-					rowss << s << " ";
-				throw string("Failed parsing a value for an aggregator. "
-						"Row: " + rowss.str());
-			}
-			aggr.second->put(value);
-		}
+	// Gets the definition, i.e. the field indices and the values that
+	// discriminate this group from the others. The values are copied, so
+	// get_key_value() is preferred where a reference is enough.
+	vector<pair<uint32_t, string>> get_definition() const {
+		vector<pair<uint32_t, string>> result;
+		for(uint32_t i = 0; i < _groupbys.size(); ++i)
+			result.emplace_back(_groupbys[i], get_key_value(i));
+		return result;
+	}
+
+	// Gets the number of the aggregators.
+	uint32_t size() const {
+		return _aggr_specs.size();
+	}
+
+	// Gets the index of the field aggregated by a given aggregator.
+	uint32_t get_field(uint32_t i) const {
+		return _aggr_specs.at(i).field;
+	}
+
+	// Gets the value of a given aggregator for this group.
+	double get_value(uint32_t i) const {
+		aggr_spec const& spec = _aggr_specs.at(i);
+		aggr::store const& store = *_stores[spec.store];
+		if(!spec.shared)
+			return store.get(_slot);
+		return spec.prototype->value_of(
+			static_cast<aggr::moments_store const&>(store).state(_slot));
 	}
 };
 
+// The copy of a group with the aggregated values. The definition consists of
+// the field indices and the ids of the values, which are only looked up in
+// the dictionaries shared with the groupper when needed.
 struct group_result {
-	vector<pair<uint32_t, string>> definition;
+	vector<pair<uint32_t, uint32_t>> definition;
 	vector<pair<uint32_t, double>> aggregators;
+	shared_ptr<vector<dictionary> const> dictionaries;
 
-	// Gets a value defining the group at a column given by the ket index.
-	string const& get_def_at(uint32_t key) const {
+	// Gets the id of a value defining the group at a column given by the
+	// key index.
+	uint32_t get_id_at(uint32_t key) const {
 		for(auto const& pr : definition)
 			if(pr.first == key)
 				return pr.second;
 		throw string("Requested a definition for a non-existent key.");
 	}
+
+	// Gets a value defining the group at a column given by the ket index.
+	string const& get_def_at(uint32_t key) const {
+		for(uint32_t i = 0; i < definition.size(); ++i)
+			if(definition[i].first == key)
+				return (*dictionaries)[i].value(definition[i].second);
+		throw string("Requested a definition for a non-existent key.");
+	}
 };
 
 class groupper {
 
+	// The number of the rows after which the buffered values are passed on
+	// to the stores.
+	static const uint32_t BLOCK_SIZE = 1024;
+
+	static const uint32_t NO_SLOT = 0xffffffff;
+
 	// Configuration.
 	// --------------
 	vector<uint32_t> _groupbys;
-	vector<string> _aggr_strs;
+	vector<aggr_spec> _aggr_specs;
+
+	// The columns referenced by the groupping fields and the aggregators.
+	input::projection _projection;
 
 	// State.
 	// ------
-	vector<group> _groups;
 
-	// Parses the aggregator construction string.
-	static void parse_aggr_str(
-			string const& aggr_str,
-			uint32_t& field,
-			aggr::ptr& aggr) {
+	// The dictionaries of the values of the groupping fields. They are
+	// shared with the results, so that the values are only copied once.
+	shared_ptr<vector<dictionary>> _dictionaries;
+
+	// The keys of the groups in the order of their creation, i.e. the ids
+	// of the values of the groupping fields, one tuple after another. The
+	// index of a key is also the slot of the group in the stores.
+	vector<uint32_t> _keys;
+	uint32_t _size;
+
+	// The key of the row being consumed.
+	vector<uint32_t> _row_key;
+
+	// The states of the aggregators of all the groups. There is a store per
+	// aggregator definition, except that the aggregators of the same field
+	// that use the moments of the values share a single store of the
+	// moments, which is updated once per value.
+	vector<aggr::store_ptr> _stores;
+
+	// The index of the field aggregated in the respective store.
+	vector<uint32_t> _store_fields;
 
-		smatch match;
+	// The index of the groups by the hash of their keys. With a single
+	// groupping field the id of its value is the key itself, so the slots
+	// are simply kept by the id instead.
+	id_index _index;
+	vector<uint32_t> _slots_by_id;
 
-		// Recognize the field to aggregator mapping.
-		sregex base_re = *_s >> (s1 = +_d) >> +_s >> (s2 = +_) >> eos;
-		if(!regex_match(aggr_str, match, base_re))
-			throw string("Unrecognize aggregator string \"") + aggr_str + "\".";
+	// The consumed rows that haven't been passed on to the stores yet:
+	// the slots of their groups and a column of values per store.
+	mutable vector<uint32_t> _block_slots;
+	mutable vector<vector<double>> _block_values;
 
-		// Parse the field index.
-		stringstream field_ss;
-		field_ss << match[1];
-		field_ss >> field;
+	// Whether the respective store takes the text of the fields. Such
+	// values aren't buffered, but passed on to the store right away, as the
+	// fields may not outlive the row.
+	vector<bool> _takes_text;
 
-		if(field_ss.fail())
-			throw string("Failed parsing the field mapping of an aggregator.");
+	// Passes on the buffered values to the stores, a column at a time.
+	void flush() const {
+		if(_block_slots.empty())
+			return;
 
-		// Parse the aggregator string.
-		auto a = aggr::create_from_string(match.str(2));
-		aggr = move(a);
+		for(uint32_t i = 0; i < _stores.size(); ++i) {
+			if(_takes_text[i])
+				continue;
+			_stores[i]->put_scatter(
+				_block_slots.data(),
+				_block_values[i].data(),
+				_block_slots.size());
+			_block_values[i].clear();
+		}
+
+		_block_slots.clear();
 	}
 
-	// Creates a group based on a definitions and a given row.
-	// The result is a group that fulfils the conditions of matching the
-	// provided row assuming the input definitions.
-	static group group_from_row(
-			vector<uint32_t> groupbys,
-			vector<string> aggr_strs,
-			vector<string> const& row) {
+	// Computes the hash of a key.
+	size_t hash_key(uint32_t const* key) const {
+		uint64_t hash = 0;
+		for(uint32_t i = 0; i < _groupbys.size(); ++i)
+			hash = (hash ^ key[i]) * 0x9e3779b97f4a7c15ULL;
+		return hash ^ (hash >> 32);
+	}
 
-		// Assign labels to the definitions.
-		vector<pair<uint32_t, string>> definition;
-		for(uint32_t gb : groupbys)
-			definition.emplace_back(gb, row[gb]);
+	// Finds the slot of the group of a given key.
+	bool find_group(size_t hash, uint32_t const* key, uint32_t& slot) const {
+		uint32_t key_size = _groupbys.size();
+		if(key_size == 1) {
+			if(key[0] >= _slots_by_id.size() || _slots_by_id[key[0]] == NO_SLOT)
+				return false;
+			slot = _slots_by_id[key[0]];
+			return true;
+		}
 
-		// Initialize a fresh set of aggregators.
-		vector<pair<uint32_t, aggr::ptr>> aggrs;
-		for(auto const& as : aggr_strs) {
-			uint32_t field;
-			aggr::ptr aggr;
-			parse_aggr_str(as, field, aggr);
-			aggrs.emplace_back(field, move(aggr));
+		return _index.find(hash, [this, key, key_size](uint32_t s) {
+			return equal(key, key + key_size, &_keys[s * key_size]);
+		}, slot);
+	}
+
+	// Appends a new group of a given key, returns its slot.
+	uint32_t add_group(size_t hash, uint32_t const* key) {
+		uint32_t slot = _size++;
+		_keys.insert(end(_keys), key, key + _groupbys.size());
+		for(auto& s : _stores)
+			s->add();
+		if(_groupbys.size() == 1) {
+			if(key[0] >= _slots_by_id.size())
+				_slots_by_id.resize(key[0] + 1, uint32_t(NO_SLOT));
+			_slots_by_id[key[0]] = slot;
+		} else {
+			_index.insert(hash, slot);
 		}
+		return slot;
+	}
 
-		return { definition, move(aggrs) };
+	// Buffers the values of the aggregated fields of a row for a given slot.
+	void buffer_row(uint32_t slot, input::row const& row) {
+		for(uint32_t i = 0; i < _stores.size(); ++i) {
+			if(_takes_text[i])
+				continue;
+			double value;
+			input::field const& f = row[_store_fields[i]];
+			if(!number::parse_double(f.data, f.data + f.size, value)) {
+				// Drop the values of this row buffered so far.
+				for(uint32_t j = 0; j < i; ++j)
+					if(!_takes_text[j])
+						_block_values[j].pop_back();
+				stringstream rowss;
+				for(input::field const& s : row)
+					rowss << s.str() << " ";
+				throw string("Failed parsing a value for an aggregator. "
+						"Row: " + rowss.str());
+			}
+			_block_values[i].push_back(value);
+		}
+
+		// The text values only once the whole row has been accepted.
+		for(uint32_t i = 0; i < _stores.size(); ++i)
+			if(_takes_text[i]) {
+				input::field const& f = row[_store_fields[i]];
+				_stores[i]->put_text(slot, f.data, f.size);
+			}
+
+		_block_slots.push_back(slot);
+		if(_block_slots.size() == BLOCK_SIZE)
+			flush();
+	}
+
+	// Tells whether an aggregator definition shares the moments with
+	// another one of the same field.
+	bool shares_moments(uint32_t i) const {
+		aggr_spec const& spec = _aggr_specs[i];
+		if(!spec.prototype->uses_moments())
+			return false;
+		for(uint32_t j = 0; j < _aggr_specs.size(); ++j)
+			if(j != i && _aggr_specs[j].field == spec.field &&
+					_aggr_specs[j].prototype->uses_moments())
+				return true;
+		return false;
+	}
+
+	// Creates the empty dictionaries and the empty stores for the compiled
+	// aggregator definitions.
+	void init() {
+		_dictionaries.reset(new vector<dictionary>(_groupbys.size()));
+		_size = 0;
+		_row_key.resize(_groupbys.size());
+
+		_projection = input::projection();
+		for(uint32_t gb : _groupbys)
+			_projection.add(gb);
+		for(auto const& spec : _aggr_specs)
+			_projection.add(spec.field);
+
+		for(uint32_t i = 0; i < _aggr_specs.size(); ++i) {
+			aggr_spec& spec = _aggr_specs[i];
+			spec.shared = shares_moments(i);
+
+			// The first of the sharing definitions creates the store.
+			bool found = false;
+			for(uint32_t j = 0; j < i && !found; ++j)
+				if(spec.shared && _aggr_specs[j].shared &&
+						_aggr_specs[j].field == spec.field) {
+					spec.store = _aggr_specs[j].store;
+					found = true;
+				}
+			if(found)
+				continue;
+
+			spec.store = _stores.size();
+			_stores.push_back(spec.shared
+				? aggr::moments().make_store()
+				: spec.prototype->make_store());
+			_store_fields.push_back(spec.field);
+			_takes_text.push_back(spec.prototype->takes_text());
+		}
+		_block_values.resize(_stores.size());
 	}
 
+	// Only used to create a fresh groupper.
+	groupper() {}
+
 public:
 	groupper(vector<uint32_t> groupbys, vector<string> aggr_strs)
 	: _groupbys(groupbys)
-	, _aggr_strs(aggr_strs)
-	{}
+	{
+		for(auto const& as : aggr_strs)
+			_aggr_specs.push_back(compile_aggr_str(as));
+		init();
+	}
 
-	// Accepts a row and assigns it to the first matching group.
+	// Accepts a row and assigns it to the matching group found in the index.
 	// If no matching group exists a new group is created based on the row
 	// and the according definitions and the row is stored in the newly
-	// created group.
+	// created group. The values of the groupping fields are looked up in
+	// the dictionaries, so the groups are matched by the ids. Throws if the
+	// row lacks any of the referenced fields.
+	void consume_row(input::row const& row) {
+		_projection.check(row);
+		for(uint32_t i = 0; i < _groupbys.size(); ++i)
+			_row_key[i] = (*_dictionaries)[i].intern(row[_groupbys[i]]);
+
+		size_t hash = hash_key(_row_key.data());
+		uint32_t slot;
+		if(!find_group(hash, _row_key.data(), slot))
+			slot = add_group(hash, _row_key.data());
+
+		buffer_row(slot, row);
+	}
+
+	// Consumes a row only if its group already exists. Returns false,
+	// leaving the groupper unchanged, otherwise.
+	bool consume_known_row(input::row const& row) {
+		_projection.check(row);
+		for(uint32_t i = 0; i < _groupbys.size(); ++i)
+			if(!(*_dictionaries)[i].find(row[_groupbys[i]], _row_key[i]))
+				return false;
+
+		size_t hash = hash_key(_row_key.data());
+		uint32_t slot;
+		if(!find_group(hash, _row_key.data(), slot))
+			return false;
+
+		buffer_row(slot, row);
+		return true;
+	}
+
+	// A convenience variant of the above for the rows of owned strings.
 	void consume_row(vector<string> const& row) {
+		input::row fields;
+		for(string const& s : row)
+			fields.push_back({ s.data(), s.size() });
+		consume_row(fields);
+	}
 
-		// Determine the index of the group to which the given data row
-		// belongs.
-		uint32_t index;
-
-		// Try among existing groups.
-		bool found = false;
-		for(uint32_t i = 0; i < _groups.size(); ++i)
-			if(_groups[i].matches_row(row)) {
-				found = true;
-				index = i;
-				break;
+	// Creates an empty groupper with the same configuration.
+	groupper fresh() const {
+		groupper result;
+		result._groupbys = _groupbys;
+		for(auto const& spec : _aggr_specs)
+			result._aggr_specs.push_back({
+				spec.field, spec.constr, spec.prototype->clone(), 0, false });
+		result.init();
+		return result;
+	}
+
+	// Merges the groups of another groupper of the same configuration.
+	// The groups that only exist in the other one are appended in their
+	// original order.
+	void merge(groupper const& other) {
+		merge(other, [](uint32_t) { return true; });
+	}
+
+	// Merges only the groups of another groupper whose slots satisfy a given
+	// predicate.
+	template<class F>
+	void merge(groupper const& other, F selected) {
+		flush();
+		other.flush();
+
+		// The ids of the other's values in this groupper's dictionaries,
+		// looked up once per value.
+		static const uint32_t UNKNOWN = 0xffffffff;
+		uint32_t key_size = _groupbys.size();
+		vector<vector<uint32_t>> translations(key_size);
+		for(uint32_t i = 0; i < key_size; ++i)
+			translations[i].assign((*other._dictionaries)[i].size(), UNKNOWN);
+
+		vector<uint32_t> key(key_size);
+		for(uint32_t other_slot = 0; other_slot < other._size; ++other_slot) {
+			if(!selected(other_slot))
+				continue;
+			for(uint32_t i = 0; i < key_size; ++i) {
+				uint32_t other_id = other._keys[other_slot * key_size + i];
+				uint32_t& id = translations[i][other_id];
+				if(id == UNKNOWN) {
+					string const& value = (*other._dictionaries)[i].value(other_id);
+					id = (*_dictionaries)[i].intern({ value.data(), value.size() });
+				}
+				key[i] = id;
 			}
 
-		// If no matching group, create a new one.
-		if(!found) {
-			index = _groups.size();
-			_groups.push_back(group_from_row(
-				_groupbys, _aggr_strs, row));
+			size_t hash = hash_key(key.data());
+			uint32_t slot;
+			if(!find_group(hash, key.data(), slot))
+				slot = add_group(hash, key.data());
+
+			for(uint32_t i = 0; i < _stores.size(); ++i)
+				_stores[i]->merge(slot, *other._stores[i], other_slot);
 		}
+	}
+
+	// Getter for the compiled aggregator definitions.
+	vector<aggr_spec> const& get_aggr_specs() const {
+		return _aggr_specs;
+	}
 
-		// Add the row at the determined index.
-		_groups[index].consume_row(row);
+	// Gets the number of the groups.
+	uint32_t size() const {
+		return _size;
+	}
+
+	// Gets the dictionary of the values of a given groupping field.
+	dictionary const& get_dictionary(uint32_t i) const {
+		return (*_dictionaries)[i];
+	}
+
+	// Getter for the indices of the groupping fields.
+	vector<uint32_t> const& get_groupbys() const {
+		return _groupbys;
+	}
+
+	// Getter for the columns referenced by the groupping fields and the
+	// aggregators, by which the input lines may be split.
+	input::projection const& get_projection() const {
+		return _projection;
+	}
+
+	// Estimates the number of the bytes occupied by the groups, i.e. by the
+	// aggregators' states, the keys and the dictionaries.
+	size_t memory() const {
+		size_t result = _keys.capacity() * sizeof(uint32_t) +
+			_slots_by_id.capacity() * sizeof(uint32_t) + _index.memory();
+		for(auto const& d : *_dictionaries)
+			result += d.memory();
+		for(auto const& s : _stores)
+			result += s->memory();
+		return result;
 	}
 
 	// Allows iteration over all the groups.
 	void for_each_group(function<void(group const&)> f) const {
-		for(auto const& g : _groups)
-			f(g);
+		flush();
+		uint32_t key_size = _groupbys.size();
+		for(uint32_t slot = 0; slot < _size; ++slot)
+			f(group(_groupbys, *_dictionaries, &_keys[slot * key_size],
+				_aggr_specs, _stores, slot));
 	}
 
 	vector<group_result> copy_result() const {
 		vector<group_result> result;
-		for(auto const& g : _groups) {
-			vector<pair<uint32_t, string>> definition;
+		shared_ptr<vector<dictionary> const> dictionaries = _dictionaries;
+		for_each_group([&result, &dictionaries, this](group const& g) {
+			vector<pair<uint32_t, uint32_t>> definition;
+			for(uint32_t i = 0; i < g.key_size(); ++i)
+				definition.emplace_back(_groupbys[i], g.get_key(i));
 			vector<pair<uint32_t, double>> aggregators;
-			for(auto const& d : g.get_definition())
-				definition.push_back(d);
-			for(auto const& a : g.get_aggregators())
-				aggregators.emplace_back(a.first, a.second->get());
-			result.push_back({ definition, aggregators });
+			for(uint32_t i = 0; i < g.size(); ++i)
+				aggregators.emplace_back(g.get_field(i), g.get_value(i));
+			result.push_back({ definition, aggregators, dictionaries });
+		});
+		return result;
+	}
+};
+
+// Groups the in-memory data with a number of threads. Each thread consumes
+// a line aligned chunk of the data with its own groupper and the partial
+// results are merged in the order of the chunks, so the groups are reported
+// in the same order as by the sequential processing. The aggregated values
+// may only differ due to the floating point rounding, as the merged partial
+// aggregations add up the values in a different order. The rows that don't
+// satisfy a given filter are skipped.
+inline groupper consume_parallel(
+		groupper const& config,
+		input::field data,
+		char delim,
+		uint32_t threads,
+		filter::predicate const& filter = filter::predicate()) {
+
+	input::projection columns = config.get_projection();
+	filter.add_columns(columns);
+
+	vector<input::field> chunks = input::split_chunks(data, threads);
+	vector<groupper> partials;
+	vector<exception_ptr> errors(threads);
+	vector<thread> workers;
+
+	for(uint32_t i = 0; i < threads; ++i)
+		partials.push_back(config.fresh());
+
+	for(uint32_t i = 0; i < threads; ++i)
+		workers.emplace_back([&, delim, i]() {
+			try {
+				input::source in(chunks[i]);
+				input::row row;
+				while(in.next_row(delim, columns, row))
+					if(filter.matches(row))
+						partials[i].consume_row(row);
+			} catch(...) {
+				errors[i] = current_exception();
+			}
+		});
+
+	for(auto& w : workers)
+		w.join();
+
+	for(auto const& e : errors)
+		if(e)
+			rethrow_exception(e);
+
+	groupper result = move(partials[0]);
+	for(uint32_t i = 1; i < threads; ++i)
+		result.merge(partials[i]);
+
+	return result;
+}
+
+// Parses the value of a given field of a row for an aggregator. The row must
+// have been checked to contain the field.
+inline double parse_field(input::row const& row, uint32_t field) {
+	input::field const& f = row[field];
+	double value;
+	if(!number::parse_double(f.data, f.data + f.size, value)) {
+		stringstream rowss;
+		for(input::field const& s : row)
+			rowss << s.str() << " ";
+		throw string("Failed parsing a value for an aggregator. "
+				"Row: " + rowss.str());
+	}
+	return value;
+}
+
+// Compares a groupping value to another one byte by byte, a prefix coming
+// first, i.e. in the order of "LC_ALL=C sort". Returns a negative number,
+// zero or a positive number if the value is less, equal or greater
+// respectively.
+inline int compare_values(input::field const& value, string const& other) {
+	size_t size = value.size < other.size() ? value.size : other.size();
+	int result = memcmp(value.data, other.data(), size);
+	if(result != 0)
+		return result;
+	if(value.size == other.size())
+		return 0;
+	return value.size < other.size() ? -1 : 1;
+}
+
+// Finds the groups of the largest weight, i.e. the number of the rows or the
+// sum of the values of a field, in the memory proportional to the number of
+// the groups looked for rather than to the number of all the groups. It uses
+// the Space-Saving algorithm: a fixed number of the groups is tracked and
+// a row of an untracked group replaces the tracked group of the least weight,
+// taking over its weight as the upper bound of the weight the new group might
+// have had so far. The weight of a group is thus overestimated by at most its
+// error, and any group heavier than the total weight divided by the number of
+// the tracked groups is guaranteed to be tracked. The aggregators of a group
+// only see the rows since it has been tracked last, which are all its rows
+// if the error is 0.
+class top_groupper {
+public:
+	// The weight field denoting that the groups are weighted by the count.
+	static const uint32_t BY_COUNT = 0xffffffff;
+
+private:
+	// The number of the groups tracked per each group looked for.
+	static const uint32_t TRACKED_PER_RESULT = 10;
+
+	groupper const& _config;
+	uint32_t _size;
+	uint32_t _capacity;
+	uint32_t _weight_field;
+	input::projection _projection;
+
+	// The values of the groupping fields of the tracked groups, each one
+	// preceded by its size, and the index of the groups by these.
+	vector<string> _keys;
+	unordered_map<string, uint32_t> _index;
+	string _row_key;
+
+	vector<double> _weights;
+	vector<double> _errors;
+	vector<aggr::store_ptr> _stores;
+	vector<double> _row_values;
+
+	// The min-heap of the slots by the weight and the position of each slot
+	// in the heap.
+	vector<uint32_t> _heap;
+	vector<uint32_t> _positions;
+
+	void swap_heap(uint32_t i, uint32_t j) {
+		swap(_heap[i], _heap[j]);
+		_positions[_heap[i]] = i;
+		_positions[_heap[j]] = j;
+	}
+
+	void sift_up(uint32_t i) {
+		while(i > 0 && _weights[_heap[i]] < _weights[_heap[(i - 1) / 2]]) {
+			swap_heap(i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+	}
+
+	// The weights only grow, so this restores the heap after an update.
+	void sift_down(uint32_t i) {
+		while(true) {
+			uint32_t least = i;
+			for(uint32_t child = 2 * i + 1; child <= 2 * i + 2; ++child)
+				if(child < _heap.size() &&
+						_weights[_heap[child]] < _weights[_heap[least]])
+					least = child;
+			if(least == i)
+				return;
+			swap_heap(i, least);
+			i = least;
+		}
+	}
+
+	// Finds the slot of the group of the current row key, tracking it in
+	// place of the lightest group if needed.
+	uint32_t find_slot() {
+		auto found = _index.find(_row_key);
+		if(found != _index.end())
+			return found->second;
+
+		uint32_t slot;
+		if(_keys.size() < _capacity) {
+			slot = _keys.size();
+			_keys.push_back(_row_key);
+			_weights.push_back(0);
+			_errors.push_back(0);
+			for(auto& store : _stores)
+				store->add();
+			_positions.push_back(_heap.size());
+			_heap.push_back(slot);
+			sift_up(_positions[slot]);
+		} else {
+			slot = _heap[0];
+			_index.erase(_keys[slot]);
+			_keys[slot] = _row_key;
+			_errors[slot] = _weights[slot];
+			for(auto& store : _stores)
+				store->reset(slot);
+		}
+		_index.emplace(_row_key, slot);
+		return slot;
+	}
+
+public:
+	// Creates a groupper that finds a given number of the heaviest groups
+	// of the configuration of a given groupper, which must outlive it. The
+	// weight is the count of the rows unless a weight field is given, whose
+	// values must then be non-negative.
+	top_groupper(groupper const& config, uint32_t size,
+			uint32_t weight_field = BY_COUNT)
+	: _config(config)
+	, _size(size)
+	, _capacity(size * TRACKED_PER_RESULT)
+	, _weight_field(weight_field)
+	, _projection(config.get_projection())
+	, _row_values(config.get_aggr_specs().size())
+	{
+		if(size == 0)
+			throw string("The number of the top groups must be positive.");
+		if(weight_field != BY_COUNT)
+			_projection.add(weight_field);
+		for(auto const& spec : config.get_aggr_specs())
+			_stores.push_back(spec.prototype->make_store());
+	}
+
+	// Accepts a row, see groupper::consume_row(). A rejected row doesn't
+	// change any of the groups.
+	void consume_row(input::row const& row) {
+		_projection.check(row);
+		_row_key.clear();
+		for(uint32_t gb : _config.get_groupbys()) {
+			input::field const& f = row[gb];
+			uint32_t size = f.size;
+			_row_key.append((char const*)&size, sizeof(size));
+			_row_key.append(f.data, f.size);
+		}
+
+		auto const& specs = _config.get_aggr_specs();
+		for(uint32_t i = 0; i < specs.size(); ++i)
+			if(!specs[i].prototype->takes_text())
+				_row_values[i] = parse_field(row, specs[i].field);
+
+		double weight = 1;
+		if(_weight_field != BY_COUNT) {
+			weight = parse_field(row, _weight_field);
+			if(!(weight >= 0))
+				throw string("The weights of the groups must be non-negative.");
 		}
+
+		uint32_t slot = find_slot();
+		_weights[slot] += weight;
+		sift_down(_positions[slot]);
+
+		for(uint32_t i = 0; i < specs.size(); ++i)
+			if(specs[i].prototype->takes_text()) {
+				input::field const& f = row[specs[i].field];
+				_stores[i]->put_text(slot, f.data, f.size);
+			} else {
+				_stores[i]->put(slot, _row_values[i]);
+			}
+	}
+
+	// A convenience variant of the above for the rows of owned strings.
+	void consume_row(vector<string> const& row) {
+		input::row fields;
+		for(string const& s : row)
+			fields.push_back({ s.data(), s.size() });
+		consume_row(fields);
+	}
+
+	// Getter for the columns referenced including the weight field.
+	input::projection const& get_projection() const {
+		return _projection;
+	}
+
+	// Calls a given function with the values of the groupping fields, the
+	// aggregated values, the weight and its error of each of the heaviest
+	// groups, from the heaviest one.
+	void for_each_result(function<void(vector<string> const&,
+			vector<double> const&, double, double)> f) const {
+		vector<uint32_t> slots(_keys.size());
+		for(uint32_t i = 0; i < slots.size(); ++i)
+			slots[i] = i;
+		sort(slots.begin(), slots.end(), [this](uint32_t a, uint32_t b) {
+			return _weights[a] > _weights[b] ||
+				(_weights[a] == _weights[b] && a < b);
+		});
+		if(slots.size() > _size)
+			slots.resize(_size);
+
+		vector<string> key(_config.get_groupbys().size());
+		vector<double> values(_stores.size());
+		for(uint32_t slot : slots) {
+			char const* current = _keys[slot].data();
+			for(string& k : key) {
+				uint32_t size;
+				memcpy(&size, current, sizeof(size));
+				k.assign(current + sizeof(size), size);
+				current += sizeof(size) + size;
+			}
+			for(uint32_t i = 0; i < values.size(); ++i)
+				values[i] = _stores[i]->get(slot);
+			f(key, values, _weights[slot], _errors[slot]);
+		}
+	}
+
+	// Gets the number of the bytes occupied by the tracked groups.
+	size_t memory() const {
+		size_t result =
+			(_weights.capacity() + _errors.capacity()) * sizeof(double) +
+			(_heap.capacity() + _positions.capacity()) * sizeof(uint32_t);
+
+		// Each key is kept both in the list and in the index.
+		for(string const& k : _keys)
+			result += 2 * (sizeof(string) + k.capacity());
+		for(auto const& s : _stores)
+			result += s->memory();
 		return result;
 	}
 };
 
+// Groups an input sorted by the groupping fields, in which the rows of each
+// group come one after another. Only the current group is kept, and it is
+// passed on as soon as a row of another group arrives. The groups must come
+// in the ascending order of the groupping values, compared with
+// compare_values() one field after another, so that a group split apart
+// isn't reported twice unnoticed.
+class sorted_groupper {
+public:
+	typedef function<void(vector<string> const&, vector<double> const&)>
+		result_handler;
+
+private:
+	groupper const& _config;
+	result_handler _handler;
+
+	bool _started;
+	uint64_t _rows;
+	vector<string> _key;
+	vector<aggr::store_ptr> _stores;
+	vector<double> _row_values;
+	vector<double> _values;
+
+	// Passes on the current group and resets the aggregators.
+	void finish_group() {
+		for(uint32_t i = 0; i < _stores.size(); ++i) {
+			_values[i] = _stores[i]->get(0);
+			_stores[i]->reset(0);
+		}
+		_handler(_key, _values);
+	}
+
+	// Compares the groupping values of a row to the current key.
+	int compare_key(input::row const& row) const {
+		auto const& groupbys = _config.get_groupbys();
+		for(uint32_t i = 0; i < groupbys.size(); ++i) {
+			int result = compare_values(row[groupbys[i]], _key[i]);
+			if(result != 0)
+				return result;
+		}
+		return 0;
+	}
+
+public:
+	// Creates a groupper with the configuration of a given one, which must
+	// outlive it, that passes each group on to a given function.
+	sorted_groupper(groupper const& config, result_handler handler)
+	: _config(config)
+	, _handler(handler)
+	, _started(false)
+	, _rows(0)
+	, _key(config.get_groupbys().size())
+	, _row_values(config.get_aggr_specs().size())
+	, _values(config.get_aggr_specs().size())
+	{
+		for(auto const& spec : config.get_aggr_specs()) {
+			_stores.push_back(spec.prototype->make_store());
+			_stores.back()->add();
+		}
+	}
+
+	// Accepts a row, passing on the current group first if the row starts
+	// another one. Throws if the row belongs before the current group.
+	void consume_row(input::row const& row) {
+		_config.get_projection().check(row);
+		auto const& specs = _config.get_aggr_specs();
+		for(uint32_t i = 0; i < specs.size(); ++i)
+			if(!specs[i].prototype->takes_text())
+				_row_values[i] = parse_field(row, specs[i].field);
+
+		int order = _started ? compare_key(row) : 1;
+		if(order < 0)
+			throw string("The input isn't sorted by the groupping fields "
+				"at the row ") + to_string(_rows + 1) + ".";
+
+		if(order > 0) {
+			if(_started)
+				finish_group();
+			auto const& groupbys = _config.get_groupbys();
+			for(uint32_t i = 0; i < groupbys.size(); ++i)
+				_key[i] = row[groupbys[i]].str();
+			_started = true;
+		}
+
+		for(uint32_t i = 0; i < specs.size(); ++i)
+			if(specs[i].prototype->takes_text()) {
+				input::field const& f = row[specs[i].field];
+				_stores[i]->put_text(0, f.data, f.size);
+			} else {
+				_stores[i]->put(0, _row_values[i]);
+			}
+		++_rows;
+	}
+
+	// A convenience variant of the above for the rows of owned strings.
+	void consume_row(vector<string> const& row) {
+		input::row fields;
+		for(string const& s : row)
+			fields.push_back({ s.data(), s.size() });
+		consume_row(fields);
+	}
+
+	// Passes on the last group once all the rows have been consumed.
+	void finish() {
+		if(_started)
+			finish_group();
+		_started = false;
+	}
+};
+
+// Groups the rows within a memory budget. The groups are kept in a groupper
+// until it occupies the given number of bytes. From then on the rows of the
+// groups that are already in the memory are still consumed by the groupper,
+// but the rows of the other groups are written to the temporary files,
+// partitioned by the hash of the values of the groupping fields. At the end
+// the groups in the memory are reported first, and then each partition is
+// groupped the same way in turn, spilling its rows into the smaller
+// partitions if needed. The results of the partitions are merged in the
+// order of the first rows of the groups. As the rows of a group are always
+// aggregated together and in their original order, the results are the same
+// as those of a single groupper, including the order of the groups.
+//
+// The states of some aggregators, e.g. the quantiles, keep growing with the
+// rows of their groups. If the groupper grows after the spilling has started
+// its groups are frozen, i.e. all the following rows are spilled. Each
+// partition is then groupped starting from the frozen groups that belong to
+// it, which differs from a single groupper only by the rounding of merging
+// the states into the fresh ones.
+class external_groupper {
+	static const uint32_t PARTITIONS = 16;
+
+	// The rows of a single huge group can't be partitioned, so at some
+	// depth the partitions are groupped in the memory regardless.
+	static const uint32_t MAX_DEPTH = 4;
+
+	typedef function<void(uint64_t, vector<string> const&,
+		vector<double> const&)> result_handler;
+
+	groupper const& _config;
+	size_t _max_memory;
+	uint32_t _depth;
+
+	groupper _groups;
+	vector<uint64_t> _first_rows;	// The first row of each group.
+	uint64_t _rows;			// The number of the rows consumed.
+	uint32_t _rows_to_check;	// The rows left until the memory is
+					// checked next.
+	size_t _spill_memory;		// The memory when the spilling started.
+	bool _frozen;			// Whether all the rows are spilled.
+
+	// The partitions of the rows of the groups that aren't in the memory.
+	vector<unique_ptr<spill::temp_file>> _partitions;
+	vector<unique_ptr<spill::writer>> _writers;
+
+	external_groupper(groupper const& config, size_t max_memory, uint32_t depth)
+	: _config(config)
+	, _max_memory(max_memory)
+	, _depth(depth)
+	, _groups(config.fresh())
+	, _rows(0)
+	, _rows_to_check(1)
+	, _spill_memory(0)
+	, _frozen(false)
+	{}
+
+	// Chooses the partition of the values of the groupping fields, given by
+	// a function of the index of the field, differently at each depth.
+	template<class F>
+	uint32_t partition_of(F value) const {
+		uint64_t hash = _depth + 1;
+		for(uint32_t i = 0; i < _config.get_groupbys().size(); ++i) {
+			input::field f = value(i);
+			hash = (hash ^ input::hash_bytes(f.data, f.size)) *
+				0x9e3779b97f4a7c15ULL;
+		}
+		hash ^= hash >> 32;
+		return hash % PARTITIONS;
+	}
+
+	// Chooses the partition of a row, which must have been checked by the
+	// groupper already.
+	uint32_t partition_of(input::row const& row) const {
+		vector<uint32_t> const& groupbys = _config.get_groupbys();
+		return partition_of([&row, &groupbys](uint32_t i) {
+			return row[groupbys[i]];
+		});
+	}
+
+	// A spilled row consists of its number, the number of the fields, the
+	// sizes of the fields and their contents.
+	void spill_row(uint64_t number, input::row const& row) {
+		spill::writer& out = *_writers[partition_of(row)];
+		out.write_value(number);
+		out.write_value(uint32_t(row.size()));
+		for(input::field const& f : row)
+			out.write_value(uint32_t(f.size));
+		for(input::field const& f : row)
+			out.write(f.data, f.size);
+	}
+
+	// Reads a spilled row, whose fields then point to the given buffer.
+	static bool read_row(spill::stream_reader& in, uint64_t& number,
+			vector<uint32_t>& sizes, vector<char>& buffer,
+			input::row& row) {
+		if(!in.read_value(number))
+			return false;
+
+		uint32_t count;
+		in.read_value(count);
+		sizes.resize(count);
+		in.read(sizes.data(), count * sizeof(uint32_t));
+
+		size_t total = 0;
+		for(uint32_t size : sizes)
+			total += size;
+		buffer.resize(total);
+		in.read(buffer.data(), total);
+
+		row.clear();
+		char const* current = buffer.data();
+		for(uint32_t size : sizes) {
+			row.push_back({ current, size });
+			current += size;
+		}
+		return true;
+	}
+
+	// A result consists of the first row of the group, the sizes and the
+	// contents of the defining values and the aggregated values.
+	static void write_result(spill::writer& out, uint64_t first_row,
+			vector<string> const& key, vector<double> const& values) {
+		out.write_value(first_row);
+		for(string const& k : key) {
+			out.write_value(uint32_t(k.size()));
+			out.write(k.data(), k.size());
+		}
+		out.write(values.data(), values.size() * sizeof(double));
+	}
+
+	static bool read_result(spill::stream_reader& in, uint64_t& first_row,
+			vector<string>& key, vector<double>& values) {
+		if(!in.read_value(first_row))
+			return false;
+		for(string& k : key) {
+			uint32_t size;
+			in.read_value(size);
+			k.resize(size);
+			in.read(&k[0], size);
+		}
+		in.read(values.data(), values.size() * sizeof(double));
+		return true;
+	}
+
+	void start_spilling() {
+		for(uint32_t p = 0; p < PARTITIONS; ++p) {
+			_partitions.emplace_back(new spill::temp_file);
+			_writers.emplace_back(new spill::writer(*_partitions.back()));
+		}
+	}
+
+	// Consumes a row of a given number.
+	void consume(uint64_t number, input::row const& row) {
+		if(_frozen) {
+			spill_row(number, row);
+			return;
+		}
+
+		if(!_partitions.empty()) {
+			if(!_groups.consume_known_row(row))
+				spill_row(number, row);
+		} else {
+			uint32_t groups = _groups.size();
+			_groups.consume_row(row);
+			if(_groups.size() != groups)
+				_first_rows.push_back(number);
+		}
+
+		// The memory is checked after a number of the rows that grows with
+		// the number of the groups, as computing it takes a pass over them.
+		if(--_rows_to_check > 0)
+			return;
+		_rows_to_check = _groups.size() / 16 > 64 ? _groups.size() / 16 : 64;
+		if(_depth >= MAX_DEPTH)
+			return;
+
+		size_t memory = _groups.memory();
+		if(_partitions.empty()) {
+			if(memory > _max_memory) {
+				start_spilling();
+				_spill_memory = memory;
+			}
+		} else if(memory > _spill_memory) {
+			_frozen = true;
+		}
+	}
+
+	// Passes on the results to a given function in the order of the first
+	// rows of the groups.
+	void finish(result_handler const& f) {
+		vector<string> key(_config.get_groupbys().size());
+		vector<double> values(_config.get_aggr_specs().size());
+
+		// The groups in the memory precede the spilled ones, unless they
+		// are frozen, in which case each is merged into its partition.
+		vector<uint32_t> group_partitions;
+		uint32_t slot = 0;
+		_groups.for_each_group([&](group const& g) {
+			if(_frozen) {
+				group_partitions.push_back(partition_of([&g](uint32_t i) {
+					string const& value = g.get_key_value(i);
+					return input::field { value.data(), value.size() };
+				}));
+				return;
+			}
+			for(uint32_t i = 0; i < key.size(); ++i)
+				key[i] = g.get_key_value(i);
+			for(uint32_t i = 0; i < values.size(); ++i)
+				values[i] = g.get_value(i);
+			f(_first_rows[slot++], key, values);
+		});
+
+		if(!_frozen) {
+			_groups = _config.fresh();
+			vector<uint64_t>().swap(_first_rows);
+		}
+		if(_partitions.empty())
+			return;
+
+		// Group the partitions one by one.
+		vector<unique_ptr<spill::temp_file>> results;
+		for(uint32_t p = 0; p < PARTITIONS; ++p) {
+			_writers[p]->flush();
+			external_groupper part(_config, _max_memory, _depth + 1);
+
+			// The frozen groups of the partition are continued by its rows.
+			if(_frozen) {
+				part._groups.merge(_groups, [&](uint32_t s) {
+					return group_partitions[s] == p;
+				});
+				for(uint32_t s = 0; s < group_partitions.size(); ++s)
+					if(group_partitions[s] == p)
+						part._first_rows.push_back(_first_rows[s]);
+				if(p == PARTITIONS - 1) {
+					_groups = _config.fresh();
+					vector<uint64_t>().swap(_first_rows);
+				}
+			}
+
+			spill::stream_reader in(*_partitions[p]);
+			uint64_t number;
+			vector<uint32_t> sizes;
+			vector<char> buffer;
+			input::row row;
+			while(read_row(in, number, sizes, buffer, row))
+				part.consume(number, row);
+			_partitions[p].reset();
+
+			results.emplace_back(new spill::temp_file);
+			spill::writer out(*results.back());
+			part.finish([&out](uint64_t first_row, vector<string> const& key,
+					vector<double> const& values) {
+				write_result(out, first_row, key, values);
+			});
+			out.flush();
+		}
+
+		// Merge the results of the partitions.
+		vector<spill::stream_reader> readers;
+		vector<uint64_t> first_rows(PARTITIONS);
+		vector<vector<string>> keys(PARTITIONS, key);
+		vector<vector<double>> values_of(PARTITIONS, values);
+		typedef pair<uint64_t, uint32_t> head;
+		priority_queue<head, vector<head>, greater<head>> heads;
+		for(uint32_t p = 0; p < PARTITIONS; ++p) {
+			readers.emplace_back(*results[p]);
+			if(read_result(readers[p], first_rows[p], keys[p], values_of[p]))
+				heads.emplace(first_rows[p], p);
+		}
+
+		while(!heads.empty()) {
+			uint32_t p = heads.top().second;
+			heads.pop();
+			f(first_rows[p], keys[p], values_of[p]);
+			if(read_result(readers[p], first_rows[p], keys[p], values_of[p]))
+				heads.emplace(first_rows[p], p);
+		}
+	}
+
+public:
+	// Creates an empty groupper with the configuration of a given one,
+	// which must outlive it, keeping at most about a given number of the
+	// bytes in the memory.
+	external_groupper(groupper const& config, size_t max_memory)
+	: external_groupper(config, max_memory, 0)
+	{}
+
+	// Accepts a row, see groupper::consume_row().
+	void consume_row(input::row const& row) {
+		consume(_rows++, row);
+	}
+
+	// Tells whether any of the rows have been spilled to the disk.
+	bool spilled() const {
+		return !_partitions.empty();
+	}
+
+	// Calls a given function with the values of the groupping fields and
+	// the aggregated values of each group, in the order of the first rows
+	// of the groups. The spilled partitions are groupped on the way, so it
+	// may only be called once, after all the rows have been consumed.
+	void for_each_result(
+			function<void(vector<string> const&, vector<double> const&)> f) {
+		finish([&f](uint64_t, vector<string> const& key,
+				vector<double> const& values) {
+			f(key, values);
+		});
+	}
+};
+
 }
 
 #endif
@@ -0,0 +1,506 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+using std::to_string;
+
+#include <cstdio>
+using std::fgets;
+using std::FILE;
+
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <unittest++/UnitTest++.h>
+using namespace UnitTest;
+
+#include "groupby.h"
+
+static const double TOLERANCE = 0.01;
+static const uint32_t NUM_ROWS = 200000;
+static const uint32_t CARDINALITY = 50000;
+static const uint32_t NUM_COLLIDING = 1000;
+
+// Builds rows of the form: key, value, with the keys repeating cyclically.
+static vector<vector<string>> make_rows(uint32_t num_rows, uint32_t cardinality) {
+	vector<vector<string>> rows;
+	for(uint32_t i = 0; i < num_rows; ++i)
+		rows.push_back({ "condition-" + to_string(i % cardinality), "1.0" });
+	return rows;
+}
+
+TEST(groups_order_test) {
+
+	vector<vector<string>> rows {
+		{ "b", "x", "1.0" },
+		{ "a", "x", "2.0" },
+		{ "b", "y", "3.0" },
+		{ "a", "x", "4.0" },
+		{ "b", "x", "5.0" } };
+
+	groupby::groupper g({ 0, 1 }, { "2 sum", "2 count" });
+	for(auto const& row : rows)
+		g.consume_row(row);
+
+	auto result = g.copy_result();
+
+	CHECK_EQUAL(3u, result.size());
+
+	CHECK(result[0].get_def_at(0) == "b");
+	CHECK(result[0].get_def_at(1) == "x");
+	CHECK_CLOSE(6.0, result[0].aggregators[0].second, TOLERANCE);
+	CHECK_CLOSE(2.0, result[0].aggregators[1].second, TOLERANCE);
+
+	CHECK(result[1].get_def_at(0) == "a");
+	CHECK(result[1].get_def_at(1) == "x");
+	CHECK_CLOSE(6.0, result[1].aggregators[0].second, TOLERANCE);
+	CHECK_CLOSE(2.0, result[1].aggregators[1].second, TOLERANCE);
+
+	CHECK(result[2].get_def_at(0) == "b");
+	CHECK(result[2].get_def_at(1) == "y");
+	CHECK_CLOSE(3.0, result[2].aggregators[0].second, TOLERANCE);
+	CHECK_CLOSE(1.0, result[2].aggregators[1].second, TOLERANCE);
+}
+
+TEST(merge_test) {
+
+	vector<vector<string>> first { { "a", "1.0" }, { "b", "2.0" } };
+	vector<vector<string>> second { { "c", "3.0" }, { "a", "4.0" } };
+
+	groupby::groupper g({ 0 }, { "1 sum" });
+	groupby::groupper other = g.fresh();
+
+	for(auto const& row : first)
+		g.consume_row(row);
+
+	for(auto const& row : second)
+		other.consume_row(row);
+
+	g.merge(other);
+	auto result = g.copy_result();
+
+	CHECK_EQUAL(3u, result.size());
+	CHECK(result[0].get_def_at(0) == "a");
+	CHECK_CLOSE(5.0, result[0].aggregators[0].second, TOLERANCE);
+	CHECK(result[1].get_def_at(0) == "b");
+	CHECK_CLOSE(2.0, result[1].aggregators[0].second, TOLERANCE);
+	CHECK(result[2].get_def_at(0) == "c");
+	CHECK_CLOSE(3.0, result[2].aggregators[0].second, TOLERANCE);
+}
+
+TEST(distinct_test) {
+
+	vector<vector<string>> rows {
+		{ "a", "s1", "1.0" },
+		{ "b", "s1", "2.0" },
+		{ "a", "s2", "3.0" },
+		{ "a", "s1", "4.0" },
+		{ "b", "s3", "5.0" } };
+
+	groupby::groupper g({ 0 }, { "1 distinct", "2 sum" });
+	for(auto const& row : rows)
+		g.consume_row(row);
+
+	// A rejected row doesn't count in either of the aggregators.
+	CHECK_THROW(g.consume_row(vector<string> { "a", "s4", "x" }), string);
+
+	auto result = g.copy_result();
+
+	CHECK_EQUAL(2u, result.size());
+	CHECK(result[0].get_def_at(0) == "a");
+	CHECK_CLOSE(2.0, result[0].aggregators[0].second, TOLERANCE);
+	CHECK_CLOSE(8.0, result[0].aggregators[1].second, TOLERANCE);
+	CHECK(result[1].get_def_at(0) == "b");
+	CHECK_CLOSE(2.0, result[1].aggregators[0].second, TOLERANCE);
+	CHECK_CLOSE(7.0, result[1].aggregators[1].second, TOLERANCE);
+}
+
+TEST(shared_moments_test) {
+
+	vector<vector<string>> rows;
+	for(uint32_t i = 0; i < 1000; ++i)
+		rows.push_back({ i % 3 ? "a" : "b", std::to_string(i * 0.37), "1" });
+
+	// The aggregators of the field 1 share the moments, unlike the single
+	// aggregators of each field.
+	vector<string> aggr_strs { "1 mean", "1 stdev", "1 ci_gauss 0.95",
+		"1 count", "1 sum", "1 min", "1 max", "2 sum" };
+	groupby::groupper shared({ 0 }, aggr_strs);
+	for(auto const& row : rows)
+		shared.consume_row(row);
+	auto shared_result = shared.copy_result();
+
+	size_t separate_memory = 0;
+	for(uint32_t i = 0; i < aggr_strs.size(); ++i) {
+		groupby::groupper separate({ 0 }, { aggr_strs[i] });
+		for(auto const& row : rows)
+			separate.consume_row(row);
+		separate_memory += separate.memory();
+
+		auto result = separate.copy_result();
+		CHECK_EQUAL(2u, result.size());
+		for(uint32_t g = 0; g < result.size(); ++g)
+			CHECK_EQUAL(result[g].aggregators[0].second,
+				shared_result[g].aggregators[i].second);
+	}
+
+	CHECK(shared.memory() < separate_memory);
+}
+
+TEST(dictionary_test) {
+
+	groupby::dictionary dict;
+	string values[] = { "condition-a", "condition-b", "condition-a" };
+	CHECK_EQUAL(0u, dict.intern({ values[0].data(), values[0].size() }));
+	CHECK_EQUAL(1u, dict.intern({ values[1].data(), values[1].size() }));
+	CHECK_EQUAL(0u, dict.intern({ values[2].data(), values[2].size() }));
+	CHECK_EQUAL(2u, dict.size());
+	CHECK(dict.value(1) == "condition-b");
+
+	// The values of each groupping field are kept once, however many groups
+	// and rows refer to them.
+	groupby::groupper g({ 0, 1 }, { "2 count" });
+	for(uint32_t i = 0; i < 1000; ++i)
+		g.consume_row(vector<string> {
+			i % 2 ? "long-condition-x" : "long-condition-y",
+			std::to_string(i % 10), "1" });
+
+	CHECK_EQUAL(10u, g.size());
+	CHECK_EQUAL(2u, g.get_dictionary(0).size());
+	CHECK_EQUAL(10u, g.get_dictionary(1).size());
+
+	auto result = g.copy_result();
+	CHECK(result[0].get_def_at(0) == "long-condition-y");
+	CHECK(result[1].get_def_at(0) == "long-condition-x");
+	CHECK_EQUAL(1u, result[1].get_id_at(0));
+	CHECK(result[9].get_def_at(1) == "9");
+}
+
+TEST(parallel_test) {
+
+	string data = "a\t1\nb\t2\na\t3\nc\t4\nb\t5\n";
+	input::field field = { data.data(), data.size() };
+
+	groupby::groupper config({ 0 }, { "1 sum", "1 count" });
+	groupby::groupper g = groupby::consume_parallel(config, field, '\t', 3);
+	auto result = g.copy_result();
+
+	CHECK_EQUAL(3u, result.size());
+	CHECK(result[0].get_def_at(0) == "a");
+	CHECK_CLOSE(4.0, result[0].aggregators[0].second, TOLERANCE);
+	CHECK_CLOSE(2.0, result[0].aggregators[1].second, TOLERANCE);
+	CHECK(result[1].get_def_at(0) == "b");
+	CHECK_CLOSE(7.0, result[1].aggregators[0].second, TOLERANCE);
+	CHECK(result[2].get_def_at(0) == "c");
+	CHECK_CLOSE(4.0, result[2].aggregators[0].second, TOLERANCE);
+}
+
+TEST(external_test) {
+
+	vector<string> aggrs = { "1 mean", "1 exact_quantile 0.5", "0 distinct" };
+	groupby::groupper config({ 0, 2 }, aggrs);
+	groupby::groupper in_memory = config.fresh();
+	groupby::external_groupper external(config, 1 << 12);
+
+	for(uint32_t i = 0; i < 20000; ++i) {
+		vector<string> row = { "key-" + to_string(i * 7919 % 3001),
+			to_string(i % 97) + ".5", to_string(i % 3) };
+		input::row fields;
+		for(string const& s : row)
+			fields.push_back({ s.data(), s.size() });
+		in_memory.consume_row(fields);
+		external.consume_row(fields);
+	}
+	CHECK(external.spilled());
+
+	// The same groups with the same values in the same order.
+	auto expected = in_memory.copy_result();
+	uint32_t i = 0;
+	external.for_each_result([&](vector<string> const& key,
+			vector<double> const& values) {
+		CHECK(i < expected.size());
+		if(i >= expected.size())
+			return;
+		CHECK(key[0] == expected[i].get_def_at(0));
+		CHECK(key[1] == expected[i].get_def_at(2));
+		for(uint32_t j = 0; j < values.size(); ++j)
+			CHECK_EQUAL(expected[i].aggregators[j].second, values[j]);
+		++i;
+	});
+	CHECK_EQUAL(expected.size(), i);
+}
+
+TEST(external_growing_test) {
+
+	// A few groups whose states keep growing after the spilling has
+	// started, and a few more groups that only appear later.
+	vector<string> aggrs = { "1 sum", "1 mean", "1 exact_quantile 0.5" };
+	groupby::groupper config({ 0 }, aggrs);
+	groupby::groupper in_memory = config.fresh();
+	groupby::external_groupper external(config, 1 << 12);
+
+	for(uint32_t i = 0; i < 50000; ++i) {
+		uint32_t groups = i < 25000 ? 8 : 16;
+		vector<string> row = { "key-" + to_string(i * 7919 % groups),
+			to_string(i % 89) + ".5" };
+		input::row fields;
+		for(string const& s : row)
+			fields.push_back({ s.data(), s.size() });
+		in_memory.consume_row(fields);
+		external.consume_row(fields);
+	}
+	CHECK(external.spilled());
+
+	auto expected = in_memory.copy_result();
+	uint32_t i = 0;
+	external.for_each_result([&](vector<string> const& key,
+			vector<double> const& values) {
+		CHECK(i < expected.size());
+		if(i >= expected.size())
+			return;
+		CHECK(key[0] == expected[i].get_def_at(0));
+		for(uint32_t j = 0; j < values.size(); ++j)
+			CHECK_CLOSE(expected[i].aggregators[j].second, values[j],
+				TOLERANCE);
+		++i;
+	});
+	CHECK_EQUAL(expected.size(), i);
+}
+
+TEST(top_test) {
+
+	// Three heavy groups among many light ones.
+	groupby::groupper config({ 0 }, { "1 sum" });
+	groupby::top_groupper top(config, 3);
+	groupby::top_groupper top_sum(config, 1, 1);
+	for(uint32_t i = 0; i < 10000; ++i) {
+		string key = i % 2 ? "light-" + to_string(i) :
+			i % 4 ? "heavy-a" : i % 16 ? "heavy-b" : "heavy-c";
+		top.consume_row(vector<string> { key, "2" });
+		top_sum.consume_row(vector<string> { key, i % 16 ? "1" : "100" });
+	}
+
+	// A rejected row doesn't change any of the groups.
+	CHECK_THROW(top.consume_row(vector<string> { "heavy-a", "x" }), string);
+	CHECK_THROW(top_sum.consume_row(vector<string> { "heavy-a", "-1" }), string);
+
+	vector<string> keys;
+	vector<double> sums;
+	vector<double> weights;
+	top.for_each_result([&](vector<string> const& key,
+			vector<double> const& values, double weight, double error) {
+		keys.push_back(key[0]);
+		sums.push_back(values[0]);
+		weights.push_back(weight);
+		CHECK(error <= weight);
+	});
+
+	CHECK_EQUAL(3u, keys.size());
+	CHECK(keys[0] == "heavy-a");
+	CHECK(keys[1] == "heavy-b");
+	CHECK(keys[2] == "heavy-c");
+	CHECK(weights[0] >= 2500);
+	CHECK(weights[2] >= 625);
+	CHECK(sums[0] <= 5000);
+
+	top_sum.for_each_result([&](vector<string> const& key,
+			vector<double> const& values, double weight, double) {
+		CHECK(key[0] == "heavy-c");
+		CHECK_CLOSE(values[0], weight, TOLERANCE);
+		CHECK(weight >= 62500);
+	});
+}
+
+TEST(sorted_test) {
+
+	// The values are in the byte order, so "10" comes before "9".
+	vector<vector<string>> rows {
+		{ "10", "a", "1.0" },
+		{ "10", "a", "2.0" },
+		{ "10", "b", "3.0" },
+		{ "9", "a", "4.0" },
+		{ "9", "a", "5.0" } };
+
+	groupby::groupper config({ 0, 1 }, { "2 sum", "2 count" });
+	vector<vector<string>> keys;
+	vector<vector<double>> values;
+	groupby::sorted_groupper g(config, [&](vector<string> const& key,
+			vector<double> const& v) {
+		keys.push_back(key);
+		values.push_back(v);
+	});
+
+	for(auto const& row : rows)
+		g.consume_row(row);
+
+	// Each group is passed on as soon as it ends.
+	CHECK_EQUAL(2u, keys.size());
+
+	// A group that has already ended can't continue.
+	CHECK_THROW(g.consume_row(vector<string> { "10", "b", "6.0" }), string);
+	g.finish();
+
+	CHECK_EQUAL(3u, keys.size());
+	CHECK(keys[0][0] == "10" && keys[0][1] == "a");
+	CHECK_CLOSE(3.0, values[0][0], TOLERANCE);
+	CHECK_CLOSE(2.0, values[0][1], TOLERANCE);
+	CHECK(keys[1][0] == "10" && keys[1][1] == "b");
+	CHECK_CLOSE(3.0, values[1][0], TOLERANCE);
+	CHECK(keys[2][0] == "9" && keys[2][1] == "a");
+	CHECK_CLOSE(9.0, values[2][0], TOLERANCE);
+	CHECK_CLOSE(2.0, values[2][1], TOLERANCE);
+}
+
+// Sorts the lines of a given text with an external command.
+static vector<string> sort_lines(string const& text, string const& command) {
+	char path[] = "/tmp/groupby_test_XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	CHECK_EQUAL(ssize_t(text.size()), write(fd, text.data(), text.size()));
+	close(fd);
+
+	vector<string> lines;
+	FILE* sorted = popen((command + " " + path).c_str(), "r");
+	CHECK(sorted);
+	char buffer[256];
+	while(fgets(buffer, sizeof(buffer), sorted)) {
+		string line = buffer;
+		if(!line.empty() && line.back() == '\n')
+			line.pop_back();
+		lines.push_back(line);
+	}
+	CHECK_EQUAL(0, pclose(sorted));
+	unlink(path);
+	return lines;
+}
+
+TEST(sorted_by_sort_test) {
+
+	// The numbers of different lengths and signs, the prefixes and the
+	// letters of both cases, rows of each group being far apart.
+	vector<string> firsts { "9", "10", "100", "-1", "1e3", "abc", "Abc",
+		"x", "x1", "x-1", "0.5" };
+	vector<string> seconds { "2", "10", "b", "B" };
+	string text;
+	groupby::groupper in_memory({ 0, 1 }, { "2 sum", "2 count" });
+	for(uint32_t i = 0; i < 1000; ++i) {
+		vector<string> row { firsts[i * 7 % firsts.size()],
+			seconds[i * 3 % seconds.size()], to_string(i % 13) };
+		in_memory.consume_row(row);
+		text += row[0] + "\t" + row[1] + "\t" + row[2] + "\n";
+	}
+
+	vector<string> commands { "LC_ALL=C sort -t \"$(printf '\\t')\" -k1,1 -k2,2",
+		"LC_ALL=C sort" };
+	for(string const& command : commands) {
+		groupby::groupper config({ 0, 1 }, { "2 sum", "2 count" });
+		uint32_t groups = 0;
+		double total = 0.0;
+		groupby::sorted_groupper g(config, [&](vector<string> const&,
+				vector<double> const& v) {
+			++groups;
+			total += v[0];
+		});
+
+		input::row row;
+		for(string const& line : sort_lines(text, command)) {
+			input::split({ line.data(), line.size() }, '\t', row);
+			g.consume_row(row);
+		}
+		g.finish();
+
+		double expected = 0.0;
+		for(auto const& grp : in_memory.copy_result())
+			expected += grp.aggregators[0].second;
+		CHECK_EQUAL(in_memory.size(), groups);
+		CHECK_CLOSE(expected, total, TOLERANCE);
+	}
+}
+
+TEST(projection_test) {
+
+	groupby::groupper g({ 2 }, { "0 sum", "1 count" });
+	CHECK_EQUAL(3u, g.get_projection().size());
+
+	// The line is only split up to the last referenced field.
+	string line = "1\t2\tx\t4\t5";
+	input::row row;
+	g.get_projection().split({ line.data(), line.size() }, '\t', row);
+	CHECK_EQUAL(3u, row.size());
+	g.consume_row(row);
+
+	// A row without a referenced field is rejected.
+	line = "1\t2";
+	CHECK_THROW(g.get_projection().split(
+		{ line.data(), line.size() }, '\t', row), string);
+	CHECK_THROW(g.consume_row(vector<string> { "1", "2" }), string);
+
+	auto result = g.copy_result();
+	CHECK_EQUAL(1u, result.size());
+	CHECK(result[0].get_def_at(2) == "x");
+	CHECK_CLOSE(1.0, result[0].aggregators[0].second, TOLERANCE);
+}
+
+TEST(colliding_hashes_test) {
+
+	// All the items share a hash, so only the matching tells them apart,
+	// also after the table has grown.
+	vector<string> items;
+	groupby::id_index index;
+	for(uint32_t i = 0; i < NUM_COLLIDING; ++i) {
+		items.push_back("item-" + to_string(i));
+		index.insert(42, i);
+	}
+
+	for(uint32_t i = 0; i < NUM_COLLIDING; ++i) {
+		uint32_t id;
+		CHECK(index.find(42, [&](uint32_t j) {
+			return items[j] == items[i];
+		}, id));
+		CHECK_EQUAL(i, id);
+	}
+
+	uint32_t id;
+	CHECK(!index.find(42, [](uint32_t) { return false; }, id));
+	CHECK(!index.find(43, [](uint32_t) { return true; }, id));
+}
+
+TEST(many_groups_test) {
+
+	auto rows = make_rows(NUM_ROWS, CARDINALITY);
+	groupby::groupper g({ 0 }, { "1 sum" });
+	for(auto const& row : rows)
+		g.consume_row(row);
+
+	auto result = g.copy_result();
+	CHECK_EQUAL(CARDINALITY, result.size());
+	for(auto const& grp : result)
+		CHECK_CLOSE(double(NUM_ROWS / CARDINALITY),
+			grp.aggregators[0].second, TOLERANCE);
+}
+
+int main() {
+	return RunAllTests();
+}
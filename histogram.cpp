@@ -19,9 +19,6 @@
  */
 
 #include <iostream>
-using std::istream;
-using std::ostream;
-using std::cin;
 using std::cout;
 using std::endl;
 
@@ -31,17 +28,54 @@ using std::stringstream;
 #include <string>
 using std::string;
 
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <thread>
+using std::thread;
+
+#include <deque>
+using std::deque;
+
+#include <chrono>
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+#include <exception>
+using std::exception_ptr;
+using std::current_exception;
+using std::rethrow_exception;
+
 #include <unistd.h>
 
 #include "histogram.h"
+#include "input.h"
+#include "number.h"
+#include "output.h"
 
 /// The common usage string.
-const string usage("Usage: histogram [-w bucket-width]");
+const string usage("Usage: histogram [-w bucket-width | -l digits] "
+	"[-j threads | -n values | -t seconds [-s panes]] [input-file]\n"
+	"       histogram -x column -y column [-w x-width[,y-width]] [-m] [input-file]");
 
 /// @brief A structure for storing the input arguments.
 struct arguments {
 	double bucket_size;	///< The width of the bucket.
+	double bucket_size_y;	///< The width of the bucket along y in 2D.
+	int x_column;		///< The column of the x values in 2D, -1 if none.
+	int y_column;		///< The column of the y values in 2D, -1 if none.
+	bool matrix;		///< Print a 2D histogram as a matrix.
+	uint32_t digits;	///< The significant digits of a log-scale histogram, 0 for linear.
 	char delim;		///< The input/output delimiter.
+	uint32_t threads;	///< The number of the processing threads.
+	uint64_t every_values;	///< The snapshot period in values, 0 if none.
+	double every_seconds;	///< The snapshot period in seconds, 0 if none.
+	uint32_t panes;		///< The number of the periods in a window.
+	string input_path;	///< The input file, empty for the standard input.
 };
 
 /// @brief Reads the input arguments and stores them in a convenient struct.
@@ -52,11 +86,28 @@ arguments parse_args(int argc, char** argv) {
 
 	arguments args;
 	args.bucket_size = 1.0;
+	args.bucket_size_y = 0.0;
+	args.x_column = -1;
+	args.y_column = -1;
+	args.matrix = false;
+	args.digits = 0;
 	args.delim = '\t';
+	args.threads = 1;
+	args.every_values = 0;
+	args.every_seconds = 0.0;
+	args.panes = 1;
 	stringstream bucketss;
+	stringstream threadss;
+	stringstream digitss;
+	stringstream valuess;
+	stringstream secondss;
+	stringstream panesss;
+	stringstream columnss;
+	char comma;
+	bool width_given = false;
 
 	int c;
-	while((c = getopt(argc, argv, "d:w:")) != -1) {
+	while((c = getopt(argc, argv, "d:w:l:j:n:t:s:x:y:m")) != -1) {
 		switch(c) {
 		case 'd':
 			if(string(optarg).size() != 1)
@@ -71,6 +122,60 @@ arguments parse_args(int argc, char** argv) {
 			bucketss >> args.bucket_size;
 			if(bucketss.fail())
 				throw string("Failed parsing the bucket width argument.");
+			if(bucketss >> comma) {
+				bucketss >> args.bucket_size_y;
+				if(comma != ',' || bucketss.fail() || !bucketss.eof())
+					throw string("Failed parsing the bucket width argument.");
+			}
+			width_given = true;
+			break;
+
+		case 'x':
+		case 'y':
+			columnss.clear();
+			columnss.str(optarg);
+			columnss >> (c == 'x' ? args.x_column : args.y_column);
+			if(columnss.fail() || (c == 'x' ? args.x_column : args.y_column) < 0)
+				throw string("Failed parsing a column index.");
+			break;
+
+		case 'm':
+			args.matrix = true;
+			break;
+
+		case 'l':
+			digitss << optarg;
+			digitss >> args.digits;
+			if(digitss.fail() || args.digits == 0)
+				throw string("Failed parsing the number of significant digits.");
+			break;
+
+		case 'j':
+			threadss << optarg;
+			threadss >> args.threads;
+			if(threadss.fail() || args.threads == 0)
+				throw string("Failed parsing the number of threads.");
+			break;
+
+		case 'n':
+			valuess << optarg;
+			valuess >> args.every_values;
+			if(valuess.fail() || args.every_values == 0)
+				throw string("Failed parsing the snapshot period in values.");
+			break;
+
+		case 't':
+			secondss << optarg;
+			secondss >> args.every_seconds;
+			if(secondss.fail() || !(args.every_seconds > 0.0))
+				throw string("Failed parsing the snapshot period in seconds.");
+			break;
+
+		case 's':
+			panesss << optarg;
+			panesss >> args.panes;
+			if(panesss.fail() || args.panes == 0)
+				throw string("Failed parsing the number of the window panes.");
 			break;
 
 		case '?':
@@ -81,26 +186,273 @@ arguments parse_args(int argc, char** argv) {
 		}
 	}
 
+	if(width_given && args.digits > 0)
+		throw string("The bucket width and the significant digits are exclusive.");
+
+	bool two_dimensional = args.x_column >= 0 || args.y_column >= 0;
+
+	if(two_dimensional) {
+		if(args.x_column < 0 || args.y_column < 0)
+			throw string("Both the x and the y columns are required.");
+		if(args.digits > 0 || args.threads > 1 ||
+				args.every_values > 0 || args.every_seconds > 0.0)
+			throw string("The 2D histogram only supports the -w and -m options.");
+		if(args.bucket_size_y == 0.0)
+			args.bucket_size_y = args.bucket_size;
+	} else if(args.matrix || args.bucket_size_y != 0.0) {
+		throw string("The matrix output and the y width require the 2D histogram.");
+	}
+
+	if(args.every_values > 0 && args.every_seconds > 0.0)
+		throw string("The snapshot period is given either in values or in seconds.");
+
+	bool windowed = args.every_values > 0 || args.every_seconds > 0.0;
+
+	if(windowed && args.threads > 1)
+		throw string("The snapshots can't be taken with multiple threads.");
+
+	if(!windowed && args.panes > 1)
+		throw string("The window panes require a snapshot period.");
+
+	// An optional input file may follow the options.
+	if(optind < argc - 1)
+		throw usage;
+
+	if(optind < argc)
+		args.input_path = argv[optind];
+
 	return args;
 }
 
 /// @brief Reads numbers from stdin and stuffs them in the histogram.
 ///
 /// @param[in] h The histogram to be filled.
-/// @param[in] in The input stream to be processed.
-void process_input(hist::histogram& h, istream& in) {
-	while(true) {
-		double value;
-		in >> value;
+/// @param[in] in The input to be processed.
+template<class HISTOGRAM>
+void process_input(HISTOGRAM& h, input::source& in) {
+	input::field line;
+	input::row words;
+	while(in.next_line(line)) {
+		input::split_words(line, words);
+		for(input::field const& w : words) {
+			double value;
+			if(!number::parse_double(w.data, w.data + w.size, value))
+				throw string("Failed reading a number from stdin.");
+			h.put(value);
+		}
+	}
+}
 
-		if(in.eof())
-			break;
+/// @brief Creates an empty histogram of the configuration of another one
+/// for a partial result, e.g. of a thread or of a window pane.
+template<class HISTOGRAM>
+HISTOGRAM empty_partial(HISTOGRAM const& h) {
+	return h;
+}
+
+/// @brief Creates an empty compact log-scale histogram, as the many partial
+/// histograms would otherwise each take the whole array of the buckets.
+hist::log_histogram empty_partial(hist::log_histogram const& h) {
+	return hist::log_histogram(h.digits(), true);
+}
+
+/// @brief Fills the histogram with a number of threads.
+///
+/// The input is split into the chunks of whole lines, each of them is put
+/// into a separate histogram by its own thread and the partial histograms
+/// are merged at the end.
+///
+/// @param[in] h The histogram to be filled.
+/// @param[in] in The input to be processed.
+/// @param[in] threads The number of the threads.
+template<class HISTOGRAM>
+void process_parallel(HISTOGRAM& h, input::source& in, uint32_t threads) {
+	vector<input::field> chunks = input::split_chunks(in.rest(), threads);
+	vector<HISTOGRAM> partials(threads, empty_partial(h));
+	vector<exception_ptr> errors(threads);
+	vector<thread> workers;
+
+	for(uint32_t i = 0; i < threads; ++i)
+		workers.emplace_back([&chunks, &partials, &errors, i]() {
+			try {
+				input::source chunk(chunks[i]);
+				process_input(partials[i], chunk);
+			} catch(...) {
+				errors[i] = current_exception();
+			}
+		});
 
-		if(in.fail())
+	for(auto& w : workers)
+		w.join();
+
+	for(auto const& e : errors)
+		if(e)
+			rethrow_exception(e);
+
+	for(auto const& p : partials)
+		h.merge(p);
+}
+
+/// @brief Prints the buckets of a linear histogram.
+///
+/// @param[in] h The histogram to be printed.
+/// @param[in] prefix The string preceding each line.
+/// @param[in] out The output to print to.
+/// @param[in] args The program arguments.
+void print(hist::histogram const& h, string const& prefix,
+		output::writer& out, arguments const& args) {
+	output::multiples centers(args.bucket_size);
+	for(const auto& pr : h.get_buckets())
+		out << prefix << centers(pr.first) << args.delim << pr.second << '\n';
+}
+
+/// @brief Prints the buckets of a log-scale histogram. The centers are
+/// printed with just enough digits to tell the neighbouring buckets apart.
+void print(hist::log_histogram const& h, string const& prefix,
+		output::writer& out, arguments const& args) {
+	h.for_each([&prefix, &out, &args](double center, double count) {
+		out << prefix << output::significant(center, args.digits + 2)
+			<< args.delim << count << '\n';
+	});
+}
+
+/// @brief Prints the snapshots of the histogram of a stream periodically.
+///
+/// The values are put into a histogram of the current period (a pane).
+/// At the end of each period the pane is added to the window histogram
+/// and the pane that has left the window, if any, is subtracted from it.
+/// Thus the memory depends on the number of the buckets and the panes but
+/// not on the length of the stream. The lines of each snapshot are
+/// preceded by its number. Each snapshot is flushed to the output at once.
+///
+/// @param[in] empty An empty histogram of the requested configuration.
+/// @param[in] in The input to be processed.
+/// @param[in] out The output to print to.
+/// @param[in] args The program arguments.
+template<class HISTOGRAM>
+void process_windows(HISTOGRAM const& empty, input::source& in,
+		output::writer& out, arguments const& args) {
+	HISTOGRAM window = empty;
+	HISTOGRAM const empty_pane = empty_partial(empty);
+	HISTOGRAM pane = empty_pane;
+	deque<HISTOGRAM> panes;
+	uint64_t pane_values = 0;
+	uint64_t snapshot = 0;
+
+	duration<double> period(args.every_seconds);
+	steady_clock::time_point deadline = steady_clock::now() +
+		duration_cast<steady_clock::duration>(period);
+
+	auto take_snapshot = [&]() {
+		window.merge(pane);
+		panes.push_back(pane);
+		if(panes.size() > args.panes) {
+			window.subtract(panes.front());
+			panes.pop_front();
+		}
+
+		stringstream prefix;
+		prefix << snapshot++ << args.delim;
+		print(window, prefix.str(), out, args);
+		out.flush();
+
+		pane = empty_pane;
+		pane_values = 0;
+	};
+
+	input::field line;
+	input::row words;
+	while(in.next_line(line)) {
+		input::split_words(line, words);
+		for(input::field const& w : words) {
+			double value;
+			if(!number::parse_double(w.data, w.data + w.size, value))
+				throw string("Failed reading a number from stdin.");
+			pane.put(value);
+			if(++pane_values == args.every_values)
+				take_snapshot();
+		}
+
+		// The time is only checked when a line arrives.
+		if(args.every_seconds > 0.0 && steady_clock::now() >= deadline) {
+			take_snapshot();
+			deadline = steady_clock::now() +
+				duration_cast<steady_clock::duration>(period);
+		}
+	}
+
+	// The values of an incomplete period.
+	if(pane_values > 0)
+		take_snapshot();
+}
+
+/// @brief Reads the pairs of values from the given columns of the input
+/// and prints their two-dimensional histogram.
+///
+/// @param[in] h The histogram to be filled.
+/// @param[in] out The output to print to.
+/// @param[in] args The program arguments.
+void run_2d(hist::histogram2d& h, output::writer& out, arguments const& args) {
+	unique_ptr<input::source> in(args.input_path.empty() ?
+		new input::source() : new input::source(args.input_path));
+
+	input::projection columns;
+	columns.add(args.x_column);
+	columns.add(args.y_column);
+
+	input::row row;
+	while(in->next_row(args.delim, columns, row)) {
+		double x, y;
+		input::field const& fx = row[args.x_column];
+		input::field const& fy = row[args.y_column];
+		if(!number::parse_double(fx.data, fx.data + fx.size, x) ||
+				!number::parse_double(fy.data, fy.data + fy.size, y))
 			throw string("Failed reading a number from stdin.");
+		h.put(x, y);
+	}
+
+	output::multiples x_centers(args.bucket_size);
+	output::multiples y_centers(args.bucket_size_y);
 
-		h.put(value);
+	if(!args.matrix) {
+		h.for_each([&](double x, double y, double count) {
+			out << x_centers(x) << args.delim << y_centers(y) << args.delim
+				<< count << '\n';
+		});
+		return;
 	}
+
+	// The header row of the x centers, preceded by an empty cell.
+	for(double x : h.x_centers())
+		out << args.delim << x_centers(x);
+	out << '\n';
+
+	h.for_each_row([&](double y, vector<double> const& counts) {
+		out << y_centers(y);
+		for(double count : counts)
+			out << args.delim << count;
+		out << '\n';
+	});
+}
+
+/// @brief Processes the input according to the arguments and prints the
+/// histogram.
+template<class HISTOGRAM>
+void run(HISTOGRAM& h, output::writer& out, arguments const& args) {
+	unique_ptr<input::source> in(args.input_path.empty() ?
+		new input::source() : new input::source(args.input_path));
+
+	if(args.every_values > 0 || args.every_seconds > 0.0) {
+		process_windows(h, *in, out, args);
+		return;
+	}
+
+	if(args.threads > 1)
+		process_parallel(h, *in, args.threads);
+	else
+		process_input(h, *in);
+
+	print(h, "", out, args);
 }
 
 int main(int argc, char** argv) {
@@ -110,10 +462,20 @@ int main(int argc, char** argv) {
 
 	try {
 		arguments args = parse_args(argc, argv);
-		hist::histogram h(args.bucket_size);
-		process_input(h, cin);
-		for(const auto& pr : h.get_buckets())
-			cout << pr.first << args.delim << pr.second << endl;
+		output::writer out;
+
+		if(args.x_column >= 0) {
+			hist::histogram2d h(args.bucket_size, args.bucket_size_y);
+			run_2d(h, out, args);
+		} else if(args.digits > 0) {
+			hist::log_histogram h(args.digits);
+			run(h, out, args);
+		} else {
+			hist::histogram h(args.bucket_size);
+			run(h, out, args);
+		}
+
+		out.flush();
 
 	} catch(string& ex) {
 		cout << ex << endl;
@@ -122,4 +484,3 @@ int main(int argc, char** argv) {
 
 	return 0;
 }
-
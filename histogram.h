@@ -21,21 +21,474 @@
 #ifndef HISTOGRAM_H
 #define HISTOGRAM_H
 
+#include <cstdint>
+
 #include <limits>
 using std::numeric_limits;
 
 #include <map>
 using std::map;
 
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include <utility>
+using std::pair;
+
+#include <unordered_map>
+using std::unordered_map;
+
+#include <algorithm>
+using std::sort;
+using std::fill;
+using std::inplace_merge;
+using std::lower_bound;
+using std::upper_bound;
+
+#include <iterator>
+
+#include <cstddef>
+
+#include <cstring>
+using std::memcpy;
+
 #include <cmath>
 using std::floor;
+using std::fabs;
+using std::ceil;
+using std::log2;
+using std::ldexp;
 
 namespace hist {
-	
-// This class contains a caching mechanism so that the re is the raw buckets
-// map that is created based on the input data and nothing else. Upon
-// request a refined buckets map is created that also contains empty
-// buckets if any are needed.
+
+// The counts of the values in the buckets given by their integer indices.
+// The counts are kept in a dense array covering the range of the indices put
+// so far, as long as the range isn't much wider than the number of the
+// non-empty buckets. Otherwise, e.g. when a few outliers lie far from the
+// rest of the values, the storage switches to an open addressing hash table.
+class bucket_counts {
+
+	// The marker of an empty slot of the hash table.
+	static const int64_t EMPTY = numeric_limits<int64_t>::min();
+
+	// The range of the indices that is always stored densely.
+	static const int64_t MIN_DENSE_SPAN = 1 << 16;
+
+	// The maximum ratio of the dense range to the number of the non-empty
+	// buckets, above which the hash table is used.
+	static const int64_t MAX_SPARSITY = 4;
+
+	// The initial sizes of the dense array and of the hash table.
+	static const size_t INITIAL_SIZE = 64;
+
+	bool _dense;
+
+	// The number of the non-empty buckets.
+	uint64_t _occupied;
+
+	// The number of the used slots of the hash table. It exceeds the number
+	// of the non-empty buckets if any counts have been subtracted.
+	uint64_t _used;
+
+	// The counts, either at the offsets from the lowest index of the dense
+	// range, or in the slots of the hash table.
+	vector<uint64_t> _counts;
+	int64_t _offset;
+
+	// The indices stored in the slots of the hash table.
+	vector<int64_t> _keys;
+
+	// The extent of the indices put so far.
+	int64_t _min;
+	int64_t _max;
+
+	// The indices of the hash table in the increasing order, and the ones
+	// added since they have been sorted the last time.
+	mutable vector<int64_t> _sorted;
+	mutable vector<int64_t> _unsorted;
+
+	size_t slot_of(int64_t index) const {
+		return (uint64_t(index) * 0x9e3779b97f4a7c15ULL) & (_keys.size() - 1);
+	}
+
+	// Finds the slot of an index in the hash table or an empty one.
+	size_t find_slot(int64_t index) const {
+		size_t slot = slot_of(index);
+		while(_keys[slot] != index && _keys[slot] != EMPTY)
+			slot = (slot + 1) & (_keys.size() - 1);
+		return slot;
+	}
+
+	// Rebuilds the hash table with a given capacity.
+	void rehash(size_t capacity) {
+		vector<int64_t> keys;
+		vector<uint64_t> counts;
+		keys.swap(_keys);
+		counts.swap(_counts);
+		_keys.assign(capacity, int64_t(EMPTY));
+		_counts.assign(capacity, 0);
+		for(size_t i = 0; i < keys.size(); ++i)
+			if(keys[i] != EMPTY) {
+				size_t slot = find_slot(keys[i]);
+				_keys[slot] = keys[i];
+				_counts[slot] = counts[i];
+			}
+	}
+
+	void add_sparse(int64_t index, uint64_t count) {
+		size_t slot = find_slot(index);
+		if(_keys[slot] == EMPTY) {
+			if((_used + 1) * 2 > _keys.size()) {
+				rehash(_keys.size() * 2);
+				slot = find_slot(index);
+			}
+			_keys[slot] = index;
+			_unsorted.push_back(index);
+			++_used;
+		}
+		_occupied += _counts[slot] == 0;
+		_counts[slot] += count;
+	}
+
+	// Rebuilds the hash table with only the non-empty buckets of a given
+	// set of indices and counts.
+	void rebuild_sparse(vector<int64_t> const& keys, vector<uint64_t> const& counts) {
+		size_t capacity = INITIAL_SIZE;
+		while(capacity < _occupied * 4)
+			capacity *= 2;
+
+		_occupied = 0;
+		_used = 0;
+		_keys.assign(capacity, int64_t(EMPTY));
+		_counts.assign(capacity, 0);
+		_sorted.clear();
+		_unsorted.clear();
+		for(size_t i = 0; i < counts.size(); ++i)
+			if(keys[i] != EMPTY && counts[i] > 0)
+				add_sparse(keys[i], counts[i]);
+	}
+
+	// Moves the non-empty dense buckets into a hash table.
+	void make_sparse() {
+		vector<uint64_t> counts;
+		counts.swap(_counts);
+
+		vector<int64_t> keys(counts.size());
+		for(size_t i = 0; i < counts.size(); ++i)
+			keys[i] = _offset + int64_t(i);
+
+		_dense = false;
+		rebuild_sparse(keys, counts);
+	}
+
+	// Drops the emptied buckets from the hash table.
+	void purge() {
+		vector<int64_t> keys;
+		vector<uint64_t> counts;
+		keys.swap(_keys);
+		counts.swap(_counts);
+		rebuild_sparse(keys, counts);
+	}
+
+	// Finds the lowest and the highest non-empty bucket after some counts
+	// have been subtracted.
+	void update_extent() {
+		if(_occupied == 0) {
+			_min = numeric_limits<int64_t>::max();
+			_max = numeric_limits<int64_t>::min();
+		} else if(_dense) {
+			while(get(_min) == 0)
+				++_min;
+			while(get(_max) == 0)
+				--_max;
+		} else {
+			vector<int64_t> const& sorted = sorted_indices();
+			auto low = lower_bound(sorted.begin(), sorted.end(), _min);
+			while(get(*low) == 0)
+				++low;
+			auto high = upper_bound(sorted.begin(), sorted.end(), _max) - 1;
+			while(get(*high) == 0)
+				--high;
+			_min = *low;
+			_max = *high;
+		}
+	}
+
+	// Handles an index outside of the dense range, either by growing the
+	// range at least twice, or by switching to the hash table.
+	void add_outside(int64_t index, uint64_t count) {
+		if(_counts.empty()) {
+			_counts.assign(INITIAL_SIZE, 0);
+			_offset = index - int64_t(INITIAL_SIZE / 2);
+		} else {
+			int64_t size = _counts.size();
+			int64_t low = index < _offset ? index : _offset;
+			int64_t high = index >= _offset + size ? index : _offset + size - 1;
+			int64_t span = high - low + 1;
+			if(span > MIN_DENSE_SPAN &&
+					span / MAX_SPARSITY > int64_t(_occupied)) {
+				make_sparse();
+				add_sparse(index, count);
+				return;
+			}
+
+			if(span < size * 2)
+				span = size * 2;
+
+			vector<uint64_t> counts(span, 0);
+			int64_t offset = index < _offset ? high - span + 1 : low;
+			for(int64_t i = 0; i < size; ++i)
+				counts[_offset - offset + i] = _counts[i];
+			_counts.swap(counts);
+			_offset = offset;
+		}
+		add(index, count);
+	}
+
+public:
+	bucket_counts()
+	: _dense(true)
+	, _occupied(0)
+	, _used(0)
+	, _offset(0)
+	, _min(numeric_limits<int64_t>::max())
+	, _max(numeric_limits<int64_t>::min())
+	{}
+
+	// Adds a count to a bucket of a given index.
+	void add(int64_t index, uint64_t count) {
+		if(index < _min) _min = index;
+		if(index > _max) _max = index;
+		if(_dense) {
+			uint64_t pos = uint64_t(index - _offset);
+			if(pos < _counts.size()) {
+				_occupied += _counts[pos] == 0;
+				_counts[pos] += count;
+			} else {
+				add_outside(index, count);
+			}
+		} else {
+			add_sparse(index, count);
+		}
+	}
+
+	// Gets the number of the non-empty buckets.
+	uint64_t occupied() const {
+		return _occupied;
+	}
+
+	// Adds all the counts of another storage.
+	void merge(bucket_counts const& other) {
+		other.for_each([this](int64_t index, uint64_t count) {
+			add(index, count);
+		});
+	}
+
+	// Subtracts the counts of another storage, which must have been added to
+	// this one before, e.g. the counts of the values that have left a window.
+	void subtract(bucket_counts const& other) {
+		other.for_each([this](int64_t index, uint64_t count) {
+			uint64_t& c = _dense ?
+				_counts[uint64_t(index - _offset)] :
+				_counts[find_slot(index)];
+			c -= count;
+			_occupied -= c == 0;
+		});
+
+		if(!_dense && _used > _occupied * 2 + INITIAL_SIZE)
+			purge();
+
+		update_extent();
+	}
+
+	// Checks whether the hash table is used.
+	bool is_sparse() const {
+		return !_dense;
+	}
+
+	// Gets the count of a bucket of a given index.
+	uint64_t get(int64_t index) const {
+		if(_dense) {
+			uint64_t pos = uint64_t(index - _offset);
+			return pos < _counts.size() ? _counts[pos] : 0;
+		}
+		return _keys.empty() ? 0 : _counts[find_slot(index)];
+	}
+
+	// Checks whether any count has been added.
+	bool empty() const {
+		return _min > _max;
+	}
+
+	// The lowest and the highest index of the buckets, if not empty.
+	int64_t min_index() const {
+		return _min;
+	}
+
+	int64_t max_index() const {
+		return _max;
+	}
+
+	// Gets the indices of the hash table in the increasing order. Only the
+	// ones added since the previous call are sorted and merged in.
+	vector<int64_t> const& sorted_indices() const {
+		if(!_unsorted.empty()) {
+			size_t middle = _sorted.size();
+			sort(begin(_unsorted), end(_unsorted));
+			_sorted.insert(end(_sorted), begin(_unsorted), end(_unsorted));
+			inplace_merge(begin(_sorted), begin(_sorted) + middle, end(_sorted));
+			_unsorted.clear();
+		}
+		return _sorted;
+	}
+
+	// Calls a function for each non-empty bucket with its index and count,
+	// in the increasing order of the indices.
+	template<class F>
+	void for_each(F f) const {
+		if(_dense) {
+			for(size_t i = 0; i < _counts.size(); ++i)
+				if(_counts[i] > 0)
+					f(_offset + int64_t(i), _counts[i]);
+		} else {
+			for(int64_t index : sorted_indices()) {
+				uint64_t count = get(index);
+				if(count > 0)
+					f(index, count);
+			}
+		}
+	}
+};
+
+// A read-only view of the buckets of a histogram, from the lowest to the
+// highest non-empty one. The pairs of the bucket centers and the counts are
+// produced on the fly while iterating, including the empty buckets between
+// the non-empty ones, so nothing is copied or materialized. The view is only
+// valid until another value is put into the histogram.
+class bucket_view {
+	bucket_counts const* _counts;
+	double _bucket_size;
+
+public:
+	class iterator : public std::iterator<
+			std::forward_iterator_tag, pair<double, double>,
+			ptrdiff_t, void, pair<double, double>> {
+		bucket_counts const* _counts;
+		double _bucket_size;
+		int64_t _index;
+
+		// For the hash table storage, the position of the next non-empty
+		// bucket in the sorted indices, so that the empty buckets between
+		// them aren't looked up.
+		vector<int64_t> const* _sorted;
+		size_t _next;
+
+	public:
+		iterator(bucket_counts const* counts, double bucket_size,
+				int64_t index)
+		: _counts(counts)
+		, _bucket_size(bucket_size)
+		, _index(index)
+		, _sorted(0)
+		, _next(0)
+		{
+			if(_counts->is_sparse()) {
+				_sorted = &_counts->sorted_indices();
+				_next = lower_bound(_sorted->begin(), _sorted->end(), index) -
+					_sorted->begin();
+			}
+		}
+
+		pair<double, double> operator*() const {
+			double center = double(_index) * _bucket_size;
+			if(_sorted && (_next == _sorted->size() || (*_sorted)[_next] != _index))
+				return { center, 0.0 };
+			return { center, double(_counts->get(_index)) };
+		}
+
+		iterator& operator++() {
+			if(_sorted && _next < _sorted->size() && (*_sorted)[_next] == _index)
+				++_next;
+			++_index;
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator result = *this;
+			++*this;
+			return result;
+		}
+
+		bool operator==(iterator const& other) const {
+			return _index == other._index;
+		}
+
+		bool operator!=(iterator const& other) const {
+			return _index != other._index;
+		}
+	};
+
+	bucket_view(bucket_counts const& counts, double bucket_size)
+	: _counts(&counts)
+	, _bucket_size(bucket_size)
+	{}
+
+	iterator begin() const {
+		return iterator(_counts, _bucket_size,
+			_counts->empty() ? 0 : _counts->min_index());
+	}
+
+	iterator end() const {
+		return iterator(_counts, _bucket_size,
+			_counts->empty() ? 0 : _counts->max_index() + 1);
+	}
+
+	// Gets the number of the buckets including the empty ones.
+	uint64_t size() const {
+		return _counts->empty() ? 0 :
+			uint64_t(_counts->max_index() - _counts->min_index()) + 1;
+	}
+
+	bool empty() const {
+		return _counts->empty();
+	}
+
+	// Materializes the buckets in a map, e.g. for the comparisons.
+	operator map<double, double>() const {
+		map<double, double> result;
+		for(auto const& pr : *this)
+			result.emplace_hint(result.end(), pr);
+		return result;
+	}
+};
+
+// Computes the index of the bucket of a given width, whose center is the
+// closest to a value. The bucket of the index i is centered at i * width.
+inline int64_t bucket_index(double value, double bucket_size) {
+
+	// The limit of the bucket indices, so that they are exactly
+	// representable both as the integers and as the doubles.
+	static const double MAX_INDEX = 9007199254740992.0;
+
+	// Establish the bucket
+	double scaled = value / bucket_size;
+	double scaled_shifted = scaled + 0.5;
+	double buck_index = floor(scaled_shifted);
+
+	// Infinities, NaNs and the absurdly large values have no bucket.
+	if(!(fabs(buck_index) <= MAX_INDEX))
+		throw string("A value out of the range of the histogram.");
+
+	return int64_t(buck_index);
+}
+
+// The histogram with the buckets of a fixed width. The bucket of a value is
+// the one whose center is closest to it. The counts are stored only for the
+// buckets that have been hit and the empty buckets in between are generated
+// when the buckets are retrieved.
 class histogram {
 
 	// Parameters.
@@ -44,57 +497,346 @@ class histogram {
 
 	// State.
 	// ------
-	map<double, double> _raw_buckets;
-	bool _cache_valid;
-	map<double, double> _cached_buckets;
+	bucket_counts _raw_buckets;
 
 public:
 	histogram(double bucket_size)
-	: _bucket_size(bucket_size)
-	, _cache_valid(false) {}
+	: _bucket_size(bucket_size) {}
 
 	// The finction for inserting a value into the histogram.
 	void put(double value) {
-		
-		// Establish the bucket
-		double scaled = value / _bucket_size;
-		double scaled_shifted = scaled + 0.5;
-		double buck_index = floor(scaled_shifted);
-
-		// Add to appropriate bucket.
-		if(_raw_buckets.find(buck_index) == end(_raw_buckets))
-			_raw_buckets[buck_index] = 1.0;
+		_raw_buckets.add(bucket_index(value, _bucket_size), 1);
+	}
+
+	// The function that returns a view of the buckets' centers and counts,
+	// including the empty buckets. It doesn't copy anything, so it is cheap
+	// to call repeatedly while the values are still being put.
+	bucket_view get_buckets() const {
+		return bucket_view(_raw_buckets, _bucket_size);
+	}
+
+	// Adds the counts of another histogram of the same bucket width, so
+	// that this one represents the values put in either of them.
+	void merge(histogram const& other) {
+		if(other._bucket_size != _bucket_size)
+			throw string("Attempted merging histograms of different bucket widths.");
+		_raw_buckets.merge(other._raw_buckets);
+	}
+
+	// Subtracts the counts of another histogram, whose values have been put
+	// into this one before.
+	void subtract(histogram const& other) {
+		if(other._bucket_size != _bucket_size)
+			throw string("Attempted subtracting histograms of different bucket widths.");
+		_raw_buckets.subtract(other._raw_buckets);
+	}
+};
+
+// The histogram with the buckets of a width proportional to their values,
+// in the manner of the HDR histograms. The width is given by the number of
+// the significant decimal digits, e.g. for 3 digits any value is within
+// 0.1% from the bounds of its bucket, be it a nanosecond or an hour.
+//
+// The bucket of a value is found directly from the bits of its binary
+// representation: the exponent and the top bits of the mantissa. The counts
+// array covers all the magnitudes between 2^-64 and 2^64 for both signs and
+// is allocated upfront, so put() takes a constant time and never allocates.
+// The values smaller in magnitude fall into the bucket of zero.
+//
+// The array takes 32 kB for 1 digit, 256 kB for 2, 2 MB for 3 and 32 MB for
+// 4 digits, too much for the many short lived partial histograms, e.g. the
+// panes of a window. A compact histogram keeps its counts in a bucket_counts
+// storage instead, which only grows with the range of the buckets used.
+class log_histogram {
+
+	// The binary exponents covered by the counts array.
+	static const int MIN_EXPONENT = -64;
+	static const int MAX_EXPONENT = 64;
+
+	// Parameters.
+	// -----------
+	uint32_t _digits;
+
+	// The number of the mantissa bits determining the bucket.
+	uint32_t _bits;
+
+	// The number of the buckets for either sign.
+	size_t _half;
+
+	// State.
+	// ------
+
+	// The negative buckets in the decreasing order of the magnitudes, the
+	// bucket of zero and the positive buckets in the increasing order. Only
+	// one of the array and the storage of a compact histogram is used.
+	vector<uint64_t> _counts;
+	bucket_counts _compact;
+	bool _is_compact;
+
+	// The lowest and the highest non-empty bucket of the array.
+	size_t _min;
+	size_t _max;
+
+	// Computes the index of a bucket for a given value.
+	size_t index_of(double value) const {
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		int exponent = int((bits >> 52) & 0x7ff) - 1023;
+
+		if(exponent < MIN_EXPONENT)
+			return _half;
+
+		if(exponent >= MAX_EXPONENT)
+			throw string("A value out of the range of the histogram.");
+
+		size_t offset = (size_t(exponent - MIN_EXPONENT) << _bits) |
+			((bits >> (52 - _bits)) & ((uint64_t(1) << _bits) - 1));
+
+		return value < 0 ? _half - 1 - offset : _half + 1 + offset;
+	}
+
+	// Adds a count to a bucket of a given index.
+	void add(size_t index, uint64_t count) {
+		if(_is_compact) {
+			_compact.add(int64_t(index), count);
+		} else {
+			_counts[index] += count;
+			if(index < _min) _min = index;
+			if(index > _max) _max = index;
+		}
+	}
+
+	// Calls a function for each non-empty bucket with its index and count.
+	template<class F>
+	void for_each_count(F f) const {
+		if(_is_compact)
+			_compact.for_each([&f](int64_t index, uint64_t count) {
+				f(size_t(index), count);
+			});
 		else
-			_raw_buckets[buck_index] += 1.0;
-
-		// Invalidate cache.
-		_cache_valid = false;
-	}
-
-	// The function that returns the refined variant of the buckets'
-	// map. It is cached so if anu value has been put in this histogram
-	// the cache must be rebuilt upon a call to this function.
-	map<double, double> get_buckets() {
-
-		// TODO: Prepare a unit test for this and refactor this function
-		// to account to the fact that the map values for non-existent
-		// keys are default initialized, and therefore there should
-		// rarely be a need to explicitly insert 0.0 into the map.
-
-		if(!_cache_valid) {
-			_cached_buckets.clear();
-			double prev_index = numeric_limits<double>::infinity();
-			for(auto& pr : _raw_buckets) {
-				double bucket_index = pr.first;
-				for(double i = prev_index + 1; i < bucket_index; i += 1.0)
-					_cached_buckets[i * _bucket_size] = 0.0;
-				_cached_buckets[bucket_index * _bucket_size] = pr.second;
-				prev_index = bucket_index;
+			for(size_t i = _min; i <= _max && i < _counts.size(); ++i)
+				if(_counts[i] > 0)
+					f(i, _counts[i]);
+	}
+
+public:
+	log_histogram(uint32_t digits, bool compact = false)
+	: _digits(digits)
+	, _is_compact(compact) {
+		if(digits < 1 || digits > 4)
+			throw string("The number of the significant digits must be between 1 and 4.");
+
+		// The relative width of a bucket is 2^-bits, at most 10^-digits.
+		_bits = uint32_t(ceil(digits * log2(10.0)));
+		_half = size_t(MAX_EXPONENT - MIN_EXPONENT) << _bits;
+		if(!compact)
+			_counts.assign(2 * _half + 1, 0);
+		_min = 2 * _half + 1;
+		_max = 0;
+	}
+
+	// Gets the number of the significant digits.
+	uint32_t digits() const {
+		return _digits;
+	}
+
+	// Checks whether the counts are kept in the compact storage.
+	bool is_compact() const {
+		return _is_compact;
+	}
+
+	// The function for inserting a value into the histogram.
+	void put(double value) {
+		if(value != value)
+			throw string("A value out of the range of the histogram.");
+
+		add(index_of(value), 1);
+	}
+
+	// Gets the midpoint of a bucket of a given index.
+	double center(size_t index) const {
+		if(index == _half)
+			return 0.0;
+
+		size_t offset = index > _half ? index - _half - 1 : _half - 1 - index;
+		int exponent = int(offset >> _bits) + MIN_EXPONENT;
+		double mantissa = 1.0 + (double(offset & ((size_t(1) << _bits) - 1)) + 0.5) /
+			double(size_t(1) << _bits);
+		double result = ldexp(mantissa, exponent);
+		return index > _half ? result : -result;
+	}
+
+	// Gets the count of a bucket of a given index.
+	uint64_t count(size_t index) const {
+		return _is_compact ? _compact.get(int64_t(index)) : _counts[index];
+	}
+
+	// Calls a function for each bucket with its midpoint and count, from the
+	// lowest to the highest non-empty bucket, including the empty ones in
+	// between.
+	template<class F>
+	void for_each(F f) const {
+		if(!_is_compact) {
+			for(size_t i = _min; i <= _max && i < _counts.size(); ++i)
+				f(center(i), double(_counts[i]));
+		} else if(!_compact.empty()) {
+			for(int64_t i = _compact.min_index(); i <= _compact.max_index(); ++i)
+				f(center(size_t(i)), double(_compact.get(i)));
+		}
+	}
+
+	// Adds the counts of another histogram of the same precision, of either
+	// form.
+	void merge(log_histogram const& other) {
+		if(other._digits != _digits)
+			throw string("Attempted merging histograms of different precisions.");
+
+		if(_is_compact && other._is_compact) {
+			_compact.merge(other._compact);
+			return;
+		}
+		other.for_each_count([this](size_t index, uint64_t count) {
+			add(index, count);
+		});
+	}
+
+	// Subtracts the counts of another histogram, whose values have been put
+	// into this one before.
+	void subtract(log_histogram const& other) {
+		if(other._digits != _digits)
+			throw string("Attempted subtracting histograms of different precisions.");
+
+		if(_is_compact) {
+			if(other._is_compact) {
+				_compact.subtract(other._compact);
+			} else {
+				log_histogram converted(_digits, true);
+				converted.merge(other);
+				_compact.subtract(converted._compact);
 			}
-			_cache_valid = true;
+			return;
+		}
+
+		other.for_each_count([this](size_t index, uint64_t count) {
+			_counts[index] -= count;
+		});
+
+		while(_min <= _max && _counts[_min] == 0)
+			++_min;
+		while(_max > _min && _counts[_max] == 0)
+			--_max;
+		if(_min > _max) {
+			_min = _counts.size();
+			_max = 0;
+		}
+	}
+};
+
+// The two-dimensional histogram of the pairs of values. The buckets of
+// each dimension are computed just like for the histogram class, each with
+// its own width. Only the non-empty cells of the grid are stored, in a hash
+// table, so the memory doesn't depend on the extent of the data.
+class histogram2d {
+
+	// The indices of the buckets along both dimensions.
+	typedef pair<int64_t, int64_t> cell;
+
+	struct cell_hash {
+		size_t operator()(cell const& c) const {
+			return size_t(uint64_t(c.first) * 0x9e3779b97f4a7c15ULL ^
+				uint64_t(c.second) * 0xc2b2ae3d27d4eb4fULL);
+		}
+	};
+
+	// Parameters.
+	// -----------
+	double _x_size;
+	double _y_size;
+
+	// State.
+	// ------
+	unordered_map<cell, uint64_t, cell_hash> _cells;
+
+	// Gets the cells in the order of the x and then of the y indices.
+	vector<pair<cell, uint64_t>> sorted_cells() const {
+		vector<pair<cell, uint64_t>> result(begin(_cells), end(_cells));
+		sort(begin(result), end(result));
+		return result;
+	}
+
+public:
+	histogram2d(double x_size, double y_size)
+	: _x_size(x_size)
+	, _y_size(y_size) {}
+
+	// Inserts a pair of values into the histogram.
+	void put(double x, double y) {
+		++_cells[cell(bucket_index(x, _x_size), bucket_index(y, _y_size))];
+	}
+
+	// Calls a function with the x and y centers and the count of each
+	// non-empty cell, in the increasing order of x and then of y.
+	template<class F>
+	void for_each(F f) const {
+		for(auto const& c : sorted_cells())
+			f(double(c.first.first) * _x_size,
+				double(c.first.second) * _y_size,
+				double(c.second));
+	}
+
+	// Calls a function for each row of the grid covering all the cells, in
+	// the increasing order of y, with the y center and the counts of the
+	// cells of the row in the order of the x centers given by x_centers().
+	template<class F>
+	void for_each_row(F f) const {
+		if(_cells.empty())
+			return;
+
+		int64_t min_x = numeric_limits<int64_t>::max();
+		int64_t max_x = numeric_limits<int64_t>::min();
+		vector<cell> by_y;
+		for(auto const& c : _cells) {
+			if(c.first.first < min_x) min_x = c.first.first;
+			if(c.first.first > max_x) max_x = c.first.first;
+			by_y.emplace_back(c.first.second, c.first.first);
 		}
+		sort(begin(by_y), end(by_y));
+
+		vector<double> row(max_x - min_x + 1);
+		int64_t y = by_y.front().first;
+		auto it = begin(by_y);
+		while(it != end(by_y)) {
+			fill(begin(row), end(row), 0.0);
+			for(; it != end(by_y) && it->first == y; ++it)
+				row[it->second - min_x] = double(_cells.at(cell(it->second, y)));
+			f(double(y) * _y_size, row);
+			++y;
+		}
+	}
+
+	// Gets the x centers of the columns of the grid.
+	vector<double> x_centers() const {
+		vector<double> result;
+		if(_cells.empty())
+			return result;
+
+		int64_t min_x = numeric_limits<int64_t>::max();
+		int64_t max_x = numeric_limits<int64_t>::min();
+		for(auto const& c : _cells) {
+			if(c.first.first < min_x) min_x = c.first.first;
+			if(c.first.first > max_x) max_x = c.first.first;
+		}
+		for(int64_t x = min_x; x <= max_x; ++x)
+			result.push_back(double(x) * _x_size);
+		return result;
+	}
 
-		return _cached_buckets;
+	// Adds the counts of another histogram of the same bucket widths.
+	void merge(histogram2d const& other) {
+		if(other._x_size != _x_size || other._y_size != _y_size)
+			throw string("Attempted merging histograms of different bucket widths.");
+		for(auto const& c : other._cells)
+			_cells[c.first] += c.second;
 	}
 };
 
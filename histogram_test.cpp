@@ -21,10 +21,24 @@
 #include <vector>
 using std::vector;
 
+#include <string>
+using std::string;
+
+#include <cstdio>
+using std::fclose;
+using std::fread;
+using std::rewind;
+using std::tmpfile;
+using std::FILE;
+
+#include <limits>
+using std::numeric_limits;
+
 #include <unittest++/UnitTest++.h>
 using namespace UnitTest;
 
 #include "histogram.h"
+#include "output.h"
 
 static const double TOLERANCE = 0.01;
 
@@ -93,6 +107,318 @@ TEST(empty_bucket_test) {
 	CHECK(expected == actual);
 }
 
+TEST(sparse_buckets_test) {
+
+	// The far outliers make the bucket range sparse.
+	hist::bucket_counts counts;
+	vector<int64_t> indices { 5, -3, 1000000000, 5, -2000000000, 7 };
+	for(int64_t i : indices)
+		counts.add(i, 1);
+
+	CHECK(counts.is_sparse());
+	CHECK_EQUAL(5u, counts.occupied());
+
+	vector<pair<int64_t, uint64_t>> expected {
+		{ -2000000000, 1 }, { -3, 1 }, { 5, 2 }, { 7, 1 }, { 1000000000, 1 } };
+	vector<pair<int64_t, uint64_t>> actual;
+	counts.for_each([&actual](int64_t index, uint64_t count) {
+		actual.emplace_back(index, count);
+	});
+
+	CHECK(expected == actual);
+}
+
+TEST(dense_growth_test) {
+
+	// The values put in both directions from the first one.
+	double bucket_width = 0.5;
+	hist::histogram h(bucket_width);
+	for(int i = 0; i < 1000; ++i) {
+		h.put(i * bucket_width);
+		h.put(-i * bucket_width);
+	}
+
+	map<double, double> actual = h.get_buckets();
+	CHECK_EQUAL(1999u, actual.size());
+	CHECK_CLOSE(2.0, actual[0.0], TOLERANCE);
+	CHECK_CLOSE(1.0, actual[-499.5], TOLERANCE);
+	CHECK_CLOSE(1.0, actual[499.5], TOLERANCE);
+}
+
+TEST(view_polling_test) {
+
+	// The view is retrieved after each value, with the far outliers
+	// switching the storage to the hash table on the way.
+	double bucket_width = 1.0;
+	vector<double> collection { 2.0, 0.0, 1000000.0, -1000000.0, 0.0, 3.0 };
+
+	hist::histogram h(bucket_width);
+	map<double, double> expected;
+	for(double e : collection) {
+		h.put(e);
+		expected[e] += 1.0;
+
+		hist::bucket_view view = h.get_buckets();
+		CHECK_EQUAL(uint64_t(expected.rbegin()->first -
+			expected.begin()->first) + 1, view.size());
+
+		// Only check the non-empty buckets, not to iterate over millions.
+		uint32_t found = 0;
+		for(auto it = view.begin(); it != view.end() && found < 3; ++it)
+			if((*it).second > 0.0) {
+				CHECK_CLOSE(expected[(*it).first], (*it).second, TOLERANCE);
+				++found;
+			}
+	}
+}
+
+TEST(merge_test) {
+
+	double bucket_width = 1.0;
+	vector<double> collection { -3.0, -1.0, 0.0, 1.0, 1.2, 7.0 };
+
+	hist::histogram whole(bucket_width);
+	hist::histogram first(bucket_width);
+	hist::histogram second(bucket_width);
+	for(uint32_t i = 0; i < collection.size(); ++i) {
+		whole.put(collection[i]);
+		(i % 2 ? first : second).put(collection[i]);
+	}
+
+	first.merge(second);
+
+	map<double, double> expected = whole.get_buckets();
+	map<double, double> actual = first.get_buckets();
+	CHECK(expected == actual);
+
+	hist::histogram other(2.0);
+	CHECK_THROW(first.merge(other), string);
+}
+
+TEST(log_histogram_test) {
+
+	// The values over many orders of magnitude, each one must lie within
+	// the relative precision from the center of its bucket.
+	uint32_t digits = 3;
+	vector<double> collection { 1e-9, 2.5e-6, 0.001, 0.5, 1.0, 1.0004,
+		42.0, 3600.0, 1e12, -7.0, 0.0 };
+
+	hist::log_histogram h(digits);
+	for(double e : collection)
+		h.put(e);
+
+	vector<pair<double, double>> buckets;
+	h.for_each([&buckets](double center, double count) {
+		if(count > 0.0)
+			buckets.emplace_back(center, count);
+	});
+
+	// 1.0 and 1.0004 share a bucket.
+	CHECK_EQUAL(collection.size() - 1, buckets.size());
+
+	for(double e : collection) {
+		bool found = false;
+		for(auto const& b : buckets)
+			if(fabs(b.first - e) <= fabs(e) * 1e-3) {
+				found = true;
+				break;
+			}
+		CHECK(found);
+	}
+
+	// The buckets go in the increasing order.
+	for(uint32_t i = 1; i < buckets.size(); ++i)
+		CHECK(buckets[i - 1].first < buckets[i].first);
+
+	hist::log_histogram other(digits);
+	other.put(42.0);
+	h.merge(other);
+	double count = 0.0;
+	h.for_each([&count](double center, double c) {
+		if(fabs(center - 42.0) < 0.042)
+			count = c;
+	});
+	CHECK_CLOSE(2.0, count, TOLERANCE);
+}
+
+TEST(compact_log_histogram_test) {
+
+	// The compact panes of a window over a fixed array histogram give the
+	// same buckets as the values put into a fixed array histogram directly.
+	uint32_t digits = 4;
+	hist::log_histogram window(digits);
+	vector<hist::log_histogram> panes;
+	for(uint32_t i = 0; i < 50; ++i) {
+		hist::log_histogram pane(digits, true);
+		CHECK(pane.is_compact());
+		for(uint32_t j = 0; j < 20; ++j)
+			pane.put(ldexp(1.0 + j * 0.01, int(i % 7) * 9 - 30) * (j % 5 ? 1 : -1));
+
+		window.merge(pane);
+		panes.push_back(pane);
+		if(panes.size() > 3)
+			window.subtract(panes[panes.size() - 4]);
+	}
+
+	hist::log_histogram expected(digits);
+	hist::log_histogram compact(digits, true);
+	for(uint32_t k = panes.size() - 3; k < panes.size(); ++k) {
+		expected.merge(panes[k]);
+		compact.merge(panes[k]);
+	}
+
+	vector<pair<double, double>> buckets[3];
+	hist::log_histogram const* histograms[3] = { &window, &expected, &compact };
+	for(uint32_t h = 0; h < 3; ++h)
+		histograms[h]->for_each([&buckets, h](double center, double count) {
+			if(count > 0.0)
+				buckets[h].emplace_back(center, count);
+		});
+	CHECK_EQUAL(60u, buckets[0].size());
+	CHECK(buckets[0] == buckets[1]);
+	CHECK(buckets[0] == buckets[2]);
+
+	// A fixed array histogram subtracted from a compact one.
+	compact.subtract(expected);
+	uint32_t non_empty = 0;
+	compact.for_each([&non_empty](double, double count) {
+		if(count > 0.0)
+			++non_empty;
+	});
+	CHECK_EQUAL(0u, non_empty);
+}
+
+TEST(subtract_test) {
+
+	// A window sliding over the values that drift far away, so that the
+	// storage becomes sparse and the emptied buckets are dropped.
+	double bucket_width = 1.0;
+	uint32_t pane_size = 10;
+	uint32_t num_panes = 3;
+
+	hist::histogram window(bucket_width);
+	vector<hist::histogram> panes;
+	for(uint32_t i = 0; i < 200; ++i) {
+		hist::histogram pane(bucket_width);
+		for(uint32_t j = 0; j < pane_size; ++j)
+			pane.put(double(i) * 100000.0 + j);
+
+		window.merge(pane);
+		panes.push_back(pane);
+		if(panes.size() > num_panes)
+			window.subtract(panes[panes.size() - num_panes - 1]);
+
+		hist::histogram expected(bucket_width);
+		for(uint32_t k = panes.size() > num_panes ? panes.size() - num_panes : 0;
+				k < panes.size(); ++k)
+			expected.merge(panes[k]);
+
+		CHECK_EQUAL(expected.get_buckets().size(), window.get_buckets().size());
+		CHECK((*expected.get_buckets().begin()) == (*window.get_buckets().begin()));
+	}
+
+	hist::histogram empty(bucket_width);
+	empty.put(1.0);
+	hist::histogram copy = empty;
+	empty.subtract(copy);
+	CHECK(empty.get_buckets().empty());
+}
+
+TEST(out_of_range_test) {
+
+	// The infinities, NaNs and the values whose bucket index isn't exact
+	// in a double are rejected, leaving the histogram untouched.
+	double inf = numeric_limits<double>::infinity();
+	double nan = numeric_limits<double>::quiet_NaN();
+
+	hist::histogram h(1.0);
+	h.put(3.0);
+	CHECK_THROW(h.put(inf), string);
+	CHECK_THROW(h.put(-inf), string);
+	CHECK_THROW(h.put(nan), string);
+	CHECK_THROW(h.put(1e20), string);
+	uint32_t buckets = 0;
+	for(auto const& pr : h.get_buckets()) {
+		CHECK_CLOSE(3.0, pr.first, TOLERANCE);
+		++buckets;
+	}
+	CHECK_EQUAL(1u, buckets);
+
+	// The same magnitude is fine with wide enough buckets.
+	hist::histogram wide(1e6);
+	wide.put(1e20);
+
+	hist::log_histogram log(3);
+	CHECK_THROW(log.put(inf), string);
+	CHECK_THROW(log.put(nan), string);
+	CHECK_THROW(log.put(1e20), string);
+	log.put(1e-20);
+
+	hist::histogram2d h2(1.0, 1.0);
+	CHECK_THROW(h2.put(1.0, inf), string);
+	CHECK_THROW(h2.put(nan, 1.0), string);
+}
+
+TEST(fractional_width_output_test) {
+
+	// The centers are multiples of the width, computed with a rounding
+	// that mustn't show in the output.
+	hist::histogram h(0.1);
+	for(double e : { 0.31, 0.29, 0.7, -0.2 })
+		h.put(e);
+
+	FILE* file = tmpfile();
+	CHECK(file);
+	{
+		output::writer out(fileno(file));
+		output::multiples centers(0.1);
+		for(auto const& pr : h.get_buckets())
+			out << centers(pr.first) << '\t' << pr.second << '\n';
+		out.flush();
+	}
+
+	string expected = "-0.2\t1\n-0.1\t0\n0\t0\n0.1\t0\n0.2\t0\n"
+		"0.3\t2\n0.4\t0\n0.5\t0\n0.6\t0\n0.7\t1\n";
+	vector<char> actual(expected.size() + 1);
+	rewind(file);
+	size_t got = fread(&actual[0], 1, actual.size(), file);
+	CHECK(string(&actual[0], got) == expected);
+	fclose(file);
+}
+
+TEST(histogram2d_test) {
+
+	hist::histogram2d h(1.0, 10.0);
+	vector<pair<double, double>> collection {
+		{ 0.1, 1.0 }, { -0.2, 4.0 }, { 2.0, 21.0 }, { 2.4, 19.0 }, { 0.0, 30.0 } };
+	for(auto const& e : collection)
+		h.put(e.first, e.second);
+
+	vector<vector<double>> expected_long {
+		{ 0.0, 0.0, 2.0 }, { 0.0, 30.0, 1.0 }, { 2.0, 20.0, 2.0 } };
+	vector<vector<double>> actual_long;
+	h.for_each([&actual_long](double x, double y, double count) {
+		actual_long.push_back({ x, y, count });
+	});
+	CHECK(expected_long == actual_long);
+
+	vector<double> expected_x { 0.0, 1.0, 2.0 };
+	CHECK(expected_x == h.x_centers());
+
+	vector<vector<double>> expected_rows {
+		{ 0.0, 2.0, 0.0, 0.0 },
+		{ 10.0, 0.0, 0.0, 0.0 },
+		{ 20.0, 0.0, 0.0, 2.0 },
+		{ 30.0, 1.0, 0.0, 0.0 } };
+	vector<vector<double>> actual_rows;
+	h.for_each_row([&actual_rows](double y, vector<double> const& counts) {
+		vector<double> row { y };
+		row.insert(row.end(), counts.begin(), counts.end());
+		actual_rows.push_back(row);
+	});
+	CHECK(expected_rows == actual_rows);
+}
+
 int main() {
 	return RunAllTests();
 }
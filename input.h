@@ -0,0 +1,357 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <cstdint>
+
+#include <cctype>
+using std::isspace;
+
+#include <cstring>
+using std::memchr;
+using std::memcmp;
+using std::memmove;
+
+#include <string>
+using std::string;
+using std::to_string;
+
+#include <vector>
+using std::vector;
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace input {
+
+// A reference to a piece of the input buffer. It doesn't own the memory, so
+// it is only valid as long as the buffer it points to.
+struct field {
+	char const* data;
+	size_t size;
+
+	// Makes an owning copy of the referenced characters.
+	string str() const {
+		return string(data, size);
+	}
+
+	bool operator==(string const& s) const {
+		return s.size() == size && memcmp(s.data(), data, size) == 0;
+	}
+
+	bool operator!=(string const& s) const {
+		return !(*this == s);
+	}
+};
+
+// A row is a list of fields. The vector is meant to be reused between the
+// rows so that no allocation happens once it has grown large enough.
+typedef vector<field> row;
+
+// The FNV-1a hash of a sequence of characters.
+inline uint64_t hash_bytes(char const* data, size_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < size; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Splits a line by a given delimiter. Just like the strtok based split()
+// from util.h it skips the empty fields. If a limit is given the rest of the
+// line after that many fields isn't scanned at all.
+inline void split(field line, char delim, row& result,
+		size_t limit = size_t(-1)) {
+	result.clear();
+	char const* current = line.data;
+	char const* end = line.data + line.size;
+	while(current < end && result.size() < limit) {
+		char const* next = (char const*)memchr(current, delim, end - current);
+		if(!next)
+			next = end;
+		if(next != current)
+			result.push_back({ current, size_t(next - current) });
+		current = next + 1;
+	}
+}
+
+// Splits a line into the words separated by any white space.
+inline void split_words(field line, row& result) {
+	result.clear();
+	char const* current = line.data;
+	char const* end = line.data + line.size;
+	while(current < end) {
+		while(current < end && isspace((unsigned char)*current))
+			++current;
+		char const* word = current;
+		while(current < end && !isspace((unsigned char)*current))
+			++current;
+		if(current != word)
+			result.push_back({ word, size_t(current - word) });
+	}
+}
+
+// The columns referenced by a program. The lines are only split up to the
+// last one of them, which for the wide inputs saves scanning most of each
+// line. A row missing any of the columns is rejected at once, so that the
+// referenced fields may be accessed without checking afterwards.
+class projection {
+	size_t _size;
+
+public:
+	projection() : _size(0) {}
+
+	void add(uint32_t column) {
+		if(column >= _size)
+			_size = size_t(column) + 1;
+	}
+
+	// Gets the number of the fields needed, i.e. the last column plus one.
+	size_t size() const {
+		return _size;
+	}
+
+	// Throws if a row doesn't contain all the referenced columns.
+	void check(row const& r) const {
+		if(r.size() >= _size)
+			return;
+		string fields;
+		for(field const& f : r)
+			fields += f.str() + " ";
+		throw "Missing the field " + to_string(_size - 1) +
+			" in the row: " + fields;
+	}
+
+	// Splits a line into the fields up to the last referenced column.
+	void split(field line, char delim, row& result) const {
+		input::split(line, delim, result, _size);
+		check(result);
+	}
+};
+
+// Splits the data into a given number of the chunks of similar size, so that
+// each of the chunks consists of whole lines.
+inline vector<field> split_chunks(field data, uint32_t count) {
+	vector<field> result;
+	char const* current = data.data;
+	char const* end = data.data + data.size;
+	for(uint32_t i = 1; i <= count; ++i) {
+		char const* next = i == count ? end : data.data + data.size / count * i;
+		if(next < current)
+			next = current;
+		if(next != end) {
+			next = (char const*)memchr(next, '\n', end - next);
+			next = next ? next + 1 : end;
+		}
+		result.push_back({ current, size_t(next - current) });
+		current = next;
+	}
+	return result;
+}
+
+// The source of the input lines. If the input is a regular file it is
+// memory mapped and the lines point directly into the mapping. Otherwise
+// (e.g. for a pipe) the data is read in large blocks into a buffer that is
+// reused, in which case a line is only valid until the next one is read.
+class source {
+
+	static const size_t BLOCK_SIZE = 1 << 20;
+
+	int _fd;
+	bool _owns_fd;
+
+	// The memory mapped variant.
+	bool _mapped;
+	char* _map;
+	size_t _map_size;
+
+	// The buffered variant.
+	vector<char> _buffer;
+	bool _eof;
+
+	// The unconsumed part of the data.
+	char const* _pos;
+	char const* _end;
+
+	source(source const&);
+	source& operator=(source const&);
+
+	// Attempts mapping the file, returns false if it isn't a regular one.
+	bool try_map() {
+		struct stat st;
+		if(fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode))
+			return false;
+
+		off_t offset = lseek(_fd, 0, SEEK_CUR);
+		if(offset < 0)
+			return false;
+
+		_map_size = st.st_size;
+		if(_map_size <= size_t(offset)) {
+			_mapped = true;
+			_pos = _end = 0;
+			return true;
+		}
+
+		void* map = mmap(0, _map_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+		if(map == MAP_FAILED)
+			return false;
+
+		_mapped = true;
+		_map = (char*)map;
+		madvise(_map, _map_size, MADV_SEQUENTIAL);
+		_pos = _map + offset;
+		_end = _map + _map_size;
+		return true;
+	}
+
+	// Reads another block into the buffer, keeping the unconsumed data.
+	bool refill() {
+		size_t left = _end - _pos;
+		size_t offset = _pos - &_buffer[0];
+		if(left == _buffer.size())
+			_buffer.resize(_buffer.size() * 2);
+
+		memmove(&_buffer[0], &_buffer[0] + offset, left);
+		_pos = &_buffer[0];
+		_end = _pos + left;
+
+		ssize_t got = read(_fd, &_buffer[0] + left, _buffer.size() - left);
+		if(got < 0)
+			throw string("Failed reading the input.");
+
+		_end += got;
+		return got > 0;
+	}
+
+	void init() {
+		_mapped = false;
+		_map = 0;
+		_map_size = 0;
+		_eof = false;
+		if(!try_map()) {
+			_buffer.resize(BLOCK_SIZE);
+			_pos = _end = &_buffer[0];
+		}
+	}
+
+public:
+	// Reads the standard input.
+	source() : _fd(0), _owns_fd(false) {
+		init();
+	}
+
+	// Reads the lines from a given piece of memory.
+	explicit source(field data) : _fd(-1), _owns_fd(false) {
+		_mapped = true;
+		_map = 0;
+		_map_size = 0;
+		_eof = false;
+		_pos = data.data;
+		_end = data.data + data.size;
+	}
+
+	// Reads a file with a given path.
+	explicit source(string const& path) : _owns_fd(true) {
+		_fd = open(path.c_str(), O_RDONLY);
+		if(_fd < 0)
+			throw string("Failed opening the input file \"") + path + "\".";
+		init();
+	}
+
+	~source() {
+		if(_map)
+			munmap(_map, _map_size);
+		if(_owns_fd)
+			close(_fd);
+	}
+
+	// Tells whether the whole input is available at once, as opposed to
+	// being read from a stream as it arrives.
+	bool is_mapped() const {
+		return _mapped;
+	}
+
+	// Fetches the next line without the line break. Returns false if there
+	// are no more lines.
+	bool next_line(field& line) {
+		while(true) {
+			char const* brk = _pos == _end ? 0 :
+				(char const*)memchr(_pos, '\n', _end - _pos);
+			if(brk) {
+				line = { _pos, size_t(brk - _pos) };
+				_pos = brk + 1;
+				return true;
+			}
+
+			if(_mapped || _eof || !refill()) {
+				_eof = true;
+				if(_pos == _end)
+					return false;
+				line = { _pos, size_t(_end - _pos) };
+				_pos = _end;
+				return true;
+			}
+		}
+	}
+
+	// Provides all the remaining input at once. For the buffered variant
+	// the rest of the stream is read into the memory. No more lines are
+	// available from the source afterwards, but the returned data is valid
+	// as long as the source exists.
+	field rest() {
+		if(!_mapped)
+			while(!_eof)
+				if(!refill())
+					_eof = true;
+
+		field result = { _pos, size_t(_end - _pos) };
+		_pos = _end;
+		return result;
+	}
+
+	// Fetches the next line and splits it into the fields.
+	bool next_row(char delim, row& result) {
+		field line;
+		if(!next_line(line))
+			return false;
+		split(line, delim, result);
+		return true;
+	}
+
+	// Fetches the next line and splits it into the fields up to the last
+	// column of a given projection.
+	bool next_row(char delim, projection const& columns, row& result) {
+		field line;
+		if(!next_line(line))
+			return false;
+		columns.split(line, delim, result);
+		return true;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string>
+using std::string;
+using std::to_string;
+
+#include <thread>
+using std::thread;
+
+#include <unistd.h>
+
+#include <unittest++/UnitTest++.h>
+using namespace UnitTest;
+
+#include "input.h"
+
+// More than a block of the buffered reader, so that the buffer must grow.
+static const size_t LONG_LINE_SIZE = 3 * (1 << 20) + 17;
+
+// Writes the data into a pipe from a thread and reads it back line by line.
+static vector<string> read_through_pipe(string const& data) {
+	int fds[2];
+	CHECK_EQUAL(0, pipe(fds));
+
+	thread producer([&data, &fds]() {
+		char const* pos = data.data();
+		size_t left = data.size();
+		while(left > 0) {
+			ssize_t written = write(fds[1], pos, left);
+			if(written <= 0)
+				break;
+			pos += written;
+			left -= written;
+		}
+		close(fds[1]);
+	});
+
+	vector<string> lines;
+	{
+		input::source in("/dev/fd/" + to_string(fds[0]));
+		input::field line;
+		while(in.next_line(line))
+			lines.push_back(line.str());
+	}
+
+	producer.join();
+	close(fds[0]);
+	return lines;
+}
+
+TEST(pipe_lines_test) {
+	vector<string> lines = read_through_pipe("a\tb\n\nc\nlast");
+	CHECK_EQUAL(4u, lines.size());
+	CHECK_EQUAL("a\tb", lines[0]);
+	CHECK_EQUAL("", lines[1]);
+	CHECK_EQUAL("c", lines[2]);
+	CHECK_EQUAL("last", lines[3]);
+}
+
+TEST(pipe_long_line_test) {
+	string long_line;
+	for(size_t i = 0; i < LONG_LINE_SIZE; ++i)
+		long_line += char('a' + i % 26);
+
+	vector<string> lines = read_through_pipe(
+		"first\n" + long_line + "\nsecond\n" + long_line);
+	CHECK_EQUAL(4u, lines.size());
+	CHECK_EQUAL("first", lines[0]);
+	CHECK(lines[1] == long_line);
+	CHECK_EQUAL("second", lines[2]);
+	CHECK(lines[3] == long_line);
+}
+
+TEST(memory_rows_test) {
+	string data = "1,2,3\n4,,5\n";
+	input::source in(input::field { data.data(), data.size() });
+	input::row row;
+
+	CHECK(in.next_row(',', row));
+	CHECK_EQUAL(3u, row.size());
+	CHECK(row[2] == "3");
+
+	// The empty fields are skipped.
+	CHECK(in.next_row(',', row));
+	CHECK_EQUAL(2u, row.size());
+	CHECK(row[1] == "5");
+
+	CHECK(!in.next_row(',', row));
+}
+
+int main() {
+	return RunAllTests();
+}
@@ -0,0 +1,231 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <cstdint>
+
+#include <cstdlib>
+using std::strtod;
+
+#include <limits>
+using std::numeric_limits;
+
+#include <string>
+using std::string;
+
+namespace number {
+
+	// The powers of ten that are exactly representable by a double.
+	static const double EXACT_POWERS_OF_10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	// The largest integer such that it and all the smaller ones are
+	// exactly representable by a double.
+	static const uint64_t MAX_EXACT_MANTISSA = 1ULL << 53;
+
+	// The number of the decimal digits that surely fit in the mantissa.
+	static const int MAX_MANTISSA_DIGITS = 19;
+
+	inline bool is_space(char c) {
+		return c == ' ' || c == '\t' || c == '\r' ||
+			c == '\n' || c == '\v' || c == '\f';
+	}
+
+	inline bool is_digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	// Case insensitive comparison of the input against a lower case word.
+	inline bool matches_word(char const* begin, char const* end, char const* word) {
+		for(; begin != end; ++begin, ++word)
+			if(!*word || (*begin | 0x20) != *word)
+				return false;
+		return !*word;
+	}
+
+	// Falls back to the standard library for the cases that can't be
+	// handled exactly by the fast path. The input has already been
+	// validated, so it is known to be a plain decimal number.
+	inline double parse_slow(char const* begin, char const* end) {
+		char buffer[64];
+		size_t size = end - begin;
+		if(size < sizeof(buffer)) {
+			string::traits_type::copy(buffer, begin, size);
+			buffer[size] = '\0';
+			return strtod(buffer, 0);
+		}
+		return strtod(string(begin, end).c_str(), 0);
+	}
+
+	// Parses a decimal floating point number that spans the entire given
+	// range, apart from any leading or trailing white space. The accepted
+	// syntax is an optional sign followed either by "inf", "infinity" or
+	// "nan" (case insensitive) or by digits with an optional fraction and
+	// an optional exponent. Hexadecimal numbers are not accepted.
+	//
+	// The function doesn't depend on the locale. The common case of the
+	// numbers with at most 19 significant digits and a small exponent is
+	// computed exactly with a single multiplication or division, and the
+	// integers don't even need that. Other numbers are passed on to strtod,
+	// which is only done for the already validated input in the "C" format.
+	//
+	// Returns false if the input is not a number, in which case the value
+	// is left untouched.
+	inline bool parse_double(char const* begin, char const* end, double& value) {
+
+		// Trim the white space.
+		while(begin != end && is_space(*begin))
+			++begin;
+		while(end != begin && is_space(end[-1]))
+			--end;
+
+		char const* p = begin;
+		if(p == end)
+			return false;
+
+		// The sign.
+		bool negative = false;
+		if(*p == '-' || *p == '+') {
+			negative = *p == '-';
+			++p;
+		}
+
+		// The special values.
+		if(p != end && !is_digit(*p) && *p != '.') {
+			double special;
+			if(matches_word(p, end, "inf") || matches_word(p, end, "infinity"))
+				special = numeric_limits<double>::infinity();
+			else if(matches_word(p, end, "nan"))
+				special = numeric_limits<double>::quiet_NaN();
+			else
+				return false;
+			value = negative ? -special : special;
+			return true;
+		}
+
+		// The integer fast path.
+		uint64_t mantissa = 0;
+		char const* digits_begin = p;
+		while(p != end && is_digit(*p) && p - digits_begin < MAX_MANTISSA_DIGITS)
+			mantissa = mantissa * 10 + (*p++ - '0');
+
+		if(p == end && p != digits_begin) {
+			if(mantissa <= MAX_EXACT_MANTISSA)
+				value = negative ? -double(mantissa) : double(mantissa);
+			else
+				value = parse_slow(begin, end);
+			return true;
+		}
+
+		// The general case. Keep collecting the significant digits as long
+		// as they fit in the mantissa, and only remember whether any of the
+		// remaining ones are not zero.
+		int significant = 0;
+		for(char const* d = digits_begin; d != p; ++d)
+			if(significant || *d != '0')
+				++significant;
+
+		int exponent = 0;
+		bool truncated = false;
+		bool any_digits = p != digits_begin;
+
+		while(p != end && is_digit(*p)) {
+			if(significant < MAX_MANTISSA_DIGITS) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if(mantissa)
+					++significant;
+			} else {
+				++exponent;
+				truncated |= *p != '0';
+			}
+			++p;
+		}
+
+		if(p != end && *p == '.') {
+			++p;
+			char const* fraction_begin = p;
+			while(p != end && is_digit(*p)) {
+				if(significant < MAX_MANTISSA_DIGITS) {
+					mantissa = mantissa * 10 + (*p - '0');
+					if(mantissa)
+						++significant;
+					--exponent;
+				} else {
+					truncated |= *p != '0';
+				}
+				++p;
+			}
+			any_digits |= p != fraction_begin;
+		}
+
+		if(!any_digits)
+			return false;
+
+		// The exponent.
+		if(p != end && (*p == 'e' || *p == 'E')) {
+			++p;
+			bool exp_negative = false;
+			if(p != end && (*p == '-' || *p == '+')) {
+				exp_negative = *p == '-';
+				++p;
+			}
+
+			if(p == end || !is_digit(*p))
+				return false;
+
+			int exp_value = 0;
+			while(p != end && is_digit(*p)) {
+				if(exp_value < 100000)
+					exp_value = exp_value * 10 + (*p - '0');
+				++p;
+			}
+
+			exponent += exp_negative ? -exp_value : exp_value;
+		}
+
+		// Anything else must not follow.
+		if(p != end)
+			return false;
+
+		// Compute the result.
+		if(truncated || mantissa > MAX_EXACT_MANTISSA ||
+				exponent < -22 || exponent > 22) {
+			value = parse_slow(begin, end);
+			return true;
+		}
+
+		double result = exponent < 0
+			? double(mantissa) / EXACT_POWERS_OF_10[-exponent]
+			: double(mantissa) * EXACT_POWERS_OF_10[exponent];
+
+		value = negative ? -result : result;
+		return true;
+	}
+
+	// A convenience variant of the above for the strings.
+	inline bool parse_double(string const& str, double& value) {
+		return parse_double(str.data(), str.data() + str.size(), value);
+	}
+}
+
+#endif
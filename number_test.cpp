@@ -0,0 +1,145 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include <cstdio>
+using std::snprintf;
+
+#include <cstring>
+using std::memcpy;
+using std::memcmp;
+
+#include <random>
+using std::mt19937_64;
+
+#include <unittest++/UnitTest++.h>
+using namespace UnitTest;
+
+#include "number.h"
+
+static const uint32_t NUM_RANDOM_CASES = 100000;
+static const double ANY_VALUE = 1.0;
+
+// Checks whether the fast parser yields a bit-exact result of strtod.
+static bool matches_strtod(string const& str) {
+	double expected = strtod(str.c_str(), 0);
+	double actual;
+	if(!number::parse_double(str, actual))
+		return false;
+	if(expected != expected)
+		return actual != actual;
+	return memcmp(&expected, &actual, sizeof(double)) == 0;
+}
+
+TEST(integers_test) {
+	vector<string> cases { "0", "1", "-1", "+7", "42", "007", "-0",
+		"123456789", "9007199254740992", "9007199254740993",
+		"18446744073709551615", "123456789012345678901234567890" };
+
+	for(string const& c : cases)
+		CHECK(matches_strtod(c));
+}
+
+TEST(fractions_test) {
+	vector<string> cases { "0.5", "-0.5", ".5", "5.", "-.25", "3.14159",
+		"0.1", "0.2", "0.3", "2.138089935", "0.000123", "100.001",
+		"0.30000000000000004", "1.7976931348623157", "4.9406564584124654",
+		"3.141592653589793238462643383279502884197",
+		"0.00000000000000000000000000000000000000001" };
+
+	for(string const& c : cases)
+		CHECK(matches_strtod(c));
+}
+
+TEST(exponents_test) {
+	vector<string> cases { "1e0", "1e22", "1e23", "1e-22", "1e-23",
+		"1E5", "-2.5e+3", "2.5e-3", "+6.02214076e23", "1.6e-19",
+		"1.7976931348623157e308", "1.7976931348623159e308", "1e309",
+		"4.9406564584124654e-324", "2.2250738585072014e-308",
+		"2.2250738585072011e-308", "1e-400", "0e999", "123e-2" };
+
+	for(string const& c : cases)
+		CHECK(matches_strtod(c));
+}
+
+TEST(special_values_test) {
+	vector<string> cases { "inf", "-inf", "+inf", "INF", "Infinity",
+		"-infinity", "nan", "-nan", "NaN" };
+
+	for(string const& c : cases)
+		CHECK(matches_strtod(c));
+}
+
+TEST(white_space_test) {
+	double value;
+
+	CHECK(number::parse_double(" 1.5\t", value));
+	CHECK_EQUAL(1.5, value);
+
+	CHECK(number::parse_double("2.5\r", value));
+	CHECK_EQUAL(2.5, value);
+}
+
+TEST(rejection_test) {
+	vector<string> cases { "", " ", "abc", "-", "+", ".", "-.", "e5",
+		"1e", "1e+", "1.2.3", "--1", "1,5", "12abc", "0x1p3", "0x10",
+		"in", "infinite", "nana", "1 2" };
+
+	double value = ANY_VALUE;
+	for(string const& c : cases) {
+		CHECK(!number::parse_double(c, value));
+		CHECK_EQUAL(ANY_VALUE, value);
+	}
+}
+
+TEST(random_round_trip_test) {
+	mt19937_64 random;
+	char buffer[512];
+	vector<char const*> formats { "%.17g", "%.15g", "%.6g", "%.3f", "%e" };
+
+	for(uint32_t i = 0; i < NUM_RANDOM_CASES; ++i) {
+		uint64_t bits = random();
+		double value;
+		memcpy(&value, &bits, sizeof(double));
+		if(value != value || value - value != 0.0)
+			continue;
+
+		for(char const* format : formats) {
+			snprintf(buffer, sizeof(buffer), format, value);
+			CHECK(matches_strtod(buffer));
+		}
+
+		// Some of the more typical magnitudes too.
+		double typical = double(bits % 100000000) / 1000.0;
+		snprintf(buffer, sizeof(buffer), "%.17g", typical);
+		CHECK(matches_strtod(buffer));
+		snprintf(buffer, sizeof(buffer), "%g", typical);
+		CHECK(matches_strtod(buffer));
+	}
+}
+
+int main() {
+	return RunAllTests();
+}
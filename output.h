@@ -0,0 +1,279 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cerrno>
+#include <cmath>
+using std::fabs;
+using std::isfinite;
+using std::signbit;
+
+#include <cstdint>
+
+#include <cstdio>
+using std::snprintf;
+
+#include <cstring>
+using std::memcpy;
+using std::strlen;
+
+#include <string>
+using std::string;
+
+#include <type_traits>
+using std::enable_if;
+using std::is_integral;
+using std::is_signed;
+
+#include <vector>
+using std::vector;
+
+#include <unistd.h>
+
+#include "input.h"
+#include "number.h"
+
+namespace output {
+
+// The space sufficient for any number formatted by the functions below.
+static const size_t MAX_NUMBER_SIZE = 32;
+
+// Formats an unsigned integer into a buffer, returns the number of the
+// characters written.
+inline size_t format_unsigned(uint64_t value, char* buffer) {
+	char digits[MAX_NUMBER_SIZE];
+	size_t size = 0;
+	do {
+		digits[size++] = '0' + value % 10;
+		value /= 10;
+	} while(value);
+	for(size_t i = 0; i < size; ++i)
+		buffer[i] = digits[size - 1 - i];
+	return size;
+}
+
+inline size_t format_signed(int64_t value, char* buffer) {
+	if(value >= 0)
+		return format_unsigned(value, buffer);
+	buffer[0] = '-';
+	return 1 + format_unsigned(-(uint64_t)value, buffer + 1);
+}
+
+// Formats a double into the shortest text that parses back to the same
+// value, in the notation of printf's "%g". The integral values, which are
+// the most common ones (the counts, the sums of the integers), are written
+// directly. Otherwise the precisions from 15 digits up are tried until the
+// value survives the round trip, 17 digits being always enough. As any
+// decimal of up to 15 digits is told apart by a normal double, "%.15g" finds
+// the shortest text whenever it is that short. For the subnormals the result
+// is still exact, just possibly longer than needed.
+inline size_t format_double(double value, char* buffer) {
+	if(value > -1e15 && value < 1e15 && value == (double)(int64_t)value &&
+			!(value == 0.0 && signbit(value)))
+		return format_signed((int64_t)value, buffer);
+
+	if(!isfinite(value))
+		return snprintf(buffer, MAX_NUMBER_SIZE, "%g", value);
+
+	size_t size = 0;
+	for(int precision = 15; precision <= 17; ++precision) {
+		size = snprintf(buffer, MAX_NUMBER_SIZE, "%.*g", precision, value);
+		double parsed;
+		if(number::parse_double(buffer, buffer + size, parsed) &&
+				parsed == value)
+			break;
+	}
+	return size;
+}
+
+// Formats a double with a given number of the significant digits, the way
+// an ostream of that precision does. The integers that fit in these digits
+// are written directly, just as "%g" would write them.
+inline size_t format_double(double value, int precision, char* buffer) {
+	if(value > -1e15 && value < 1e15 && value == (double)(int64_t)value &&
+			!(value == 0.0 && signbit(value))) {
+		size_t size = format_signed((int64_t)value, buffer);
+		if(int(size) - (value < 0.0) <= precision)
+			return size;
+	}
+	return snprintf(buffer, MAX_NUMBER_SIZE, "%.*g", precision, value);
+}
+
+// A double to be written with a given number of the significant digits
+// instead of the exact representation.
+struct significant {
+	double value;
+	int precision;
+
+	significant(double value, int precision) :
+		value(value), precision(precision) {}
+};
+
+// Counts the significant digits of the shortest exact form of a number.
+inline int significant_digits(double value) {
+	char buffer[MAX_NUMBER_SIZE];
+	size_t size = format_double(value, buffer);
+	int digits = 0;
+	for(size_t i = 0; i < size && buffer[i] != 'e'; ++i)
+		if(buffer[i] >= '1' && buffer[i] <= '9')
+			++digits;
+		else if(buffer[i] == '0' && digits > 0)
+			++digits;
+	return digits > 0 ? digits : 1;
+}
+
+// Formats the multiples of a step, such as the bucket centers of a histogram.
+// A multiple has at most as many significant digits as the step and the
+// factor together, so writing it with these drops the rounding noise of the
+// multiplication, e.g. 3 * 0.1 is written as 0.3 rather than as
+// 0.30000000000000004, while the result is still exact.
+class multiples {
+	double _step;
+	int _step_digits;
+
+public:
+	explicit multiples(double step) :
+		_step(step), _step_digits(significant_digits(step)) {}
+
+	significant operator()(double value) const {
+		int digits = _step_digits + 1;
+		for(double factor = fabs(value / _step); factor >= 10.0 && digits < 17;
+				factor /= 10.0)
+			++digits;
+		return significant(value, digits < 17 ? digits : 17);
+	}
+};
+
+// A buffered writer of the program output to a file descriptor. It replaces
+// the iostreams, which flushed the output on each endl and formatted the
+// numbers through the locale. The output is only written when the buffer
+// fills up or on an explicit flush(), so a program should flush before
+// returning, or at least let the writer be destroyed, which flushes while
+// ignoring the errors.
+class writer {
+
+	static const size_t BUFFER_SIZE = 1 << 16;
+
+	int _fd;
+	vector<char> _buffer;
+	size_t _used;
+
+	writer(writer const&);
+	writer& operator=(writer const&);
+
+	void write_all(char const* data, size_t size) {
+		while(size > 0) {
+			ssize_t written = ::write(_fd, data, size);
+			if(written < 0) {
+				if(errno == EINTR)
+					continue;
+				throw string("Failed writing the output.");
+			}
+			data += written;
+			size -= written;
+		}
+	}
+
+	// Makes sure that a number may be formatted at the end of the buffer.
+	char* reserve_number() {
+		if(_buffer.size() - _used < MAX_NUMBER_SIZE)
+			flush();
+		return &_buffer[_used];
+	}
+
+public:
+	// Writes to the standard output by default.
+	explicit writer(int fd = 1) :
+		_fd(fd), _buffer(BUFFER_SIZE), _used(0) {}
+
+	~writer() {
+		try {
+			flush();
+		} catch(string&) {}
+	}
+
+	void flush() {
+		size_t used = _used;
+		_used = 0;
+		write_all(&_buffer[0], used);
+	}
+
+	void write(char const* data, size_t size) {
+		if(_buffer.size() - _used < size) {
+			flush();
+			if(size >= _buffer.size()) {
+				write_all(data, size);
+				return;
+			}
+		}
+		memcpy(&_buffer[_used], data, size);
+		_used += size;
+	}
+
+	writer& operator<<(char c) {
+		if(_used == _buffer.size())
+			flush();
+		_buffer[_used++] = c;
+		return *this;
+	}
+
+	writer& operator<<(char const* str) {
+		write(str, strlen(str));
+		return *this;
+	}
+
+	writer& operator<<(string const& str) {
+		write(str.data(), str.size());
+		return *this;
+	}
+
+	writer& operator<<(input::field const& f) {
+		write(f.data, f.size);
+		return *this;
+	}
+
+	writer& operator<<(double value) {
+		char* buffer = reserve_number();
+		_used += format_double(value, buffer);
+		return *this;
+	}
+
+	writer& operator<<(significant const& s) {
+		char* buffer = reserve_number();
+		_used += format_double(s.value, s.precision, buffer);
+		return *this;
+	}
+
+	template<class T>
+	typename enable_if<is_integral<T>::value, writer&>::type
+	operator<<(T value) {
+		char* buffer = reserve_number();
+		_used += is_signed<T>::value
+			? format_signed(value, buffer)
+			: format_unsigned(value, buffer);
+		return *this;
+	}
+};
+
+}
+
+#endif
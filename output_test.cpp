@@ -0,0 +1,183 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include <cstdio>
+using std::fclose;
+using std::fread;
+using std::rewind;
+using std::snprintf;
+using std::tmpfile;
+using std::FILE;
+
+#include <cstdlib>
+using std::strtod;
+
+#include <cstring>
+using std::memcpy;
+using std::memcmp;
+
+#include <limits>
+using std::numeric_limits;
+
+#include <random>
+using std::mt19937_64;
+
+#include <unittest++/UnitTest++.h>
+using namespace UnitTest;
+
+#include "output.h"
+
+static const uint32_t NUM_RANDOM_CASES = 100000;
+
+static string format(double value) {
+	char buffer[output::MAX_NUMBER_SIZE];
+	return string(buffer, output::format_double(value, buffer));
+}
+
+// Checks whether the text parses back into the bit-exact value.
+static bool round_trips(double value) {
+	double parsed = strtod(format(value).c_str(), 0);
+	return memcmp(&value, &parsed, sizeof(double)) == 0;
+}
+
+TEST(integers_test) {
+	CHECK_EQUAL("0", format(0.0));
+	CHECK_EQUAL("-0", format(-0.0));
+	CHECK_EQUAL("1", format(1.0));
+	CHECK_EQUAL("-42", format(-42.0));
+	CHECK_EQUAL("1703180", format(1703180.0));
+	CHECK_EQUAL("999999999999999", format(999999999999999.0));
+	CHECK_EQUAL("1e+15", format(1e15));
+	CHECK_EQUAL("9007199254740992", format(9007199254740992.0));
+}
+
+TEST(shortest_test) {
+	CHECK_EQUAL("0.1", format(0.1));
+	CHECK_EQUAL("0.30000000000000004", format(0.1 + 0.2));
+	CHECK_EQUAL("0.3333333333333333", format(1.0 / 3.0));
+	CHECK_EQUAL("2.5", format(2.5));
+	CHECK_EQUAL("1e-05", format(0.00001));
+	CHECK_EQUAL("1.7976931348623157e+308",
+		format(numeric_limits<double>::max()));
+
+	// The subnormals aren't necessarily the shortest, but still exact.
+	CHECK(round_trips(numeric_limits<double>::denorm_min()));
+}
+
+TEST(special_values_test) {
+	CHECK_EQUAL("inf", format(numeric_limits<double>::infinity()));
+	CHECK_EQUAL("-inf", format(-numeric_limits<double>::infinity()));
+	CHECK_EQUAL("nan", format(numeric_limits<double>::quiet_NaN()));
+}
+
+TEST(significant_test) {
+	char buffer[output::MAX_NUMBER_SIZE];
+	size_t size = output::format_double(1.0 / 3.0, 4, buffer);
+	CHECK_EQUAL("0.3333", string(buffer, size));
+	size = output::format_double(1234567.0, 3, buffer);
+	CHECK_EQUAL("1.23e+06", string(buffer, size));
+
+	// The integers only bypass "%g" where it would write them whole.
+	vector<double> integers { 0.0, -0.0, 5.0, -5.0, 100000.0, 999999.0,
+		1000000.0, -1234567.0, 1e14 };
+	char expected[output::MAX_NUMBER_SIZE];
+	for(double value : integers) {
+		size = output::format_double(value, 6, buffer);
+		snprintf(expected, sizeof(expected), "%.6g", value);
+		CHECK_EQUAL(string(expected), string(buffer, size));
+	}
+}
+
+TEST(multiples_test) {
+	char buffer[output::MAX_NUMBER_SIZE];
+	auto format_multiple = [&buffer](output::multiples const& m, double value) {
+		output::significant s = m(value);
+		return string(buffer, output::format_double(s.value, s.precision, buffer));
+	};
+
+	output::multiples tenths(0.1);
+	CHECK_EQUAL("0.3", format_multiple(tenths, 3 * 0.1));
+	CHECK_EQUAL("0.7", format_multiple(tenths, 7 * 0.1));
+	CHECK_EQUAL("-0.3", format_multiple(tenths, -3 * 0.1));
+	CHECK_EQUAL("0", format_multiple(tenths, 0.0));
+	CHECK_EQUAL("123456.7", format_multiple(tenths, 1234567 * 0.1));
+
+	output::multiples odd(0.07);
+	CHECK_EQUAL("-0.28", format_multiple(odd, -4 * 0.07));
+
+	output::multiples large(2.5e9);
+	CHECK_EQUAL("7500000000", format_multiple(large, 3 * 2.5e9));
+
+	output::multiples tiny(2.5e-20);
+	CHECK_EQUAL("7.5e-20", format_multiple(tiny, 3 * 2.5e-20));
+}
+
+TEST(random_round_trip_test) {
+	mt19937_64 random;
+	for(uint32_t i = 0; i < NUM_RANDOM_CASES; ++i) {
+		uint64_t bits = random();
+		double value;
+		memcpy(&value, &bits, sizeof(double));
+		if(value != value || value - value != 0.0)
+			continue;
+		CHECK(round_trips(value));
+
+		// Some of the more typical magnitudes too.
+		double typical = double(bits % 100000000) / 1000.0;
+		CHECK(round_trips(typical));
+		CHECK(format(typical).size() <= 12);
+	}
+}
+
+TEST(writer_test) {
+	FILE* file = tmpfile();
+	CHECK(file);
+
+	// More than the buffer holds, with a piece larger than it.
+	string large(100000, 'x');
+	string expected;
+	{
+		output::writer out(fileno(file));
+		for(uint32_t i = 0; i < 10000; ++i) {
+			out << i << '\t' << "a" << string("b") << i / 4.0 << '\n';
+			expected += to_string(i) + "\tab" + format(i / 4.0) + "\n";
+		}
+		out << large << -7 << output::significant(0.123456, 2);
+		expected += large + "-70.12";
+		out.flush();
+	}
+
+	vector<char> actual(expected.size() + 1);
+	rewind(file);
+	size_t got = fread(&actual[0], 1, actual.size(), file);
+	CHECK_EQUAL(expected.size(), got);
+	CHECK(string(&actual[0], got) == expected);
+	fclose(file);
+}
+
+int main() {
+	return RunAllTests();
+}
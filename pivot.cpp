@@ -31,30 +31,23 @@ using std::set;
 using std::string;
 
 #include <iostream>
-using std::istream;
-using std::ostream;
-using std::cin;
 using std::cout;
 using std::endl;
 
+#include <memory>
+using std::unique_ptr;
+
 #include <boost/lexical_cast.hpp>
 using boost::lexical_cast;
 using boost::bad_lexical_cast;
 
-#include <boost/xpressive/xpressive.hpp>
-using boost::xpressive::sregex;
-using boost::xpressive::smatch;
-using boost::xpressive::s1;
-using boost::xpressive::s2;
-using boost::xpressive::_d;
-using boost::xpressive::_s;
-using boost::xpressive::_;
-using boost::xpressive::eos;
-
 #include <unistd.h>
 
 #include "util.h"
+#include "filter.h"
+#include "input.h"
 #include "groupby.h"
+#include "output.h"
 
 // Handle the command line arguments.
 // ----------------------------------
@@ -66,6 +59,9 @@ struct arguments {
 	bool expect_data_header;		// Expect column captions in 1st row?
 	vector<vector<uint32_t>> dimensions;	// Pivot dimension definitions.
 	vector<string> aggr_strs;		// Aggregators' construction strings.
+	string input_path;			// Input file, stdin if empty.
+	uint32_t threads;			// The number of processing threads.
+	filter::predicate filter;		// The filter of the rows.
 };
 
 // Peals out a single dimension definition which is expected to be a
@@ -100,9 +96,10 @@ arguments parse_args(int argc, char** argv) {
 	args.hide_domain = false;
 	args.print_headers = false;
 	args.expect_data_header = false;
+	args.threads = 1;
 
 	int c;
-	while((c = getopt(argc, argv, "a:d:D:RhHn")) != -1) {
+	while((c = getopt(argc, argv, "a:d:D:f:j:RhHn")) != -1) {
 		switch(c) {
 		case 'a':
 			args.aggr_strs.emplace_back(optarg);
@@ -122,6 +119,19 @@ arguments parse_args(int argc, char** argv) {
 			args.dimensions.push_back(parse_dim_arg(optarg));
 			break;
 
+		case 'f':
+			args.filter.add(optarg);
+			break;
+
+		case 'j': {
+			stringstream converter;
+			converter << optarg;
+			converter >> args.threads;
+			if(converter.fail() || args.threads == 0)
+				throw string("Failed parsing the number of threads.");
+			break;
+		}
+
 		case 'n':
 			args.hide_domain = true;
 			break;
@@ -147,6 +157,13 @@ arguments parse_args(int argc, char** argv) {
 				throw string("Option -D requires a dimension"
 						"argument.");
 
+			if(optopt == 'f')
+				throw string("Option -f requires a filter expression.");
+
+			if(optopt == 'j')
+				throw string("Option -j requires a number of "
+						"threads.");
+
 			// Notice a fallthrough. It is here although it should
 			// not happen unless someone changes the getopt options
 			// definition.
@@ -156,17 +173,23 @@ arguments parse_args(int argc, char** argv) {
 		}
 	}
 
+	// An optional input file may follow the options.
+	if(optind < argc - 1)
+		throw string("At most one input file may be given.");
+
+	if(optind < argc)
+		args.input_path = argv[optind];
+
 	return args;
 }
 
 // Reading additional data from the input header.
-map<uint32_t, string> process_header(istream& in, arguments const& args) {
+map<uint32_t, string> process_header(input::source& in, arguments const& args) {
 	map<uint32_t, string> result;
-	string line;
-	getline(in, line);
-	vector<string> row = split(line, args.delim);
+	input::row row;
+	in.next_row(args.delim, row);
 	for(uint32_t i = 0; i < row.size(); ++i)
-		result[i] = row[i];
+		result[i] = row[i].str();
 	return result;
 }
 
@@ -174,7 +197,7 @@ map<uint32_t, string> process_header(istream& in, arguments const& args) {
 // --------------------
 
 groupby::groupper perform_groupping(
-		istream& in, 
+		input::source& in,
 		arguments const& args) {
 
 	// Flatten the dimension definitions.
@@ -188,14 +211,18 @@ groupby::groupper perform_groupping(
 						"definition.");
 
 	groupby::groupper g(groupbys, args.aggr_strs);
-	string line;
-	while(true) {
-		getline(in, line);
-		if(!in.good())
-			break;
-		vector<string> row = split(line, args.delim);
-		g.consume_row(row);
-	}
+
+	if(args.threads > 1)
+		return groupby::consume_parallel(
+			g, in.rest(), args.delim, args.threads, args.filter);
+
+	input::projection columns = g.get_projection();
+	args.filter.add_columns(columns);
+
+	input::row row;
+	while(in.next_row(args.delim, columns, row))
+		if(args.filter.matches(row))
+			g.consume_row(row);
 
 	return g;
 }
@@ -221,8 +248,58 @@ bool smart_less(string const& l, string const& r) {
 	return l < r;
 }
 
+// The values of the groupping columns, indexed by the column, with their
+// ranks in the orders of the rows and of the columns of the table, so that
+// the groups are compared by the ids of their values.
+struct column_keys {
+	vector<groupby::dictionary const*> dictionaries;
+	vector<vector<uint32_t>> smart_ranks;
+	vector<vector<uint32_t>> lexical_ranks;
+
+	string const& value(uint32_t col, uint32_t id) const {
+		return dictionaries[col]->value(id);
+	}
+};
+
+// Ranks the values of a dictionary in the order defined by a given function.
+template<class Less>
+vector<uint32_t> rank_values(groupby::dictionary const& dict, Less less) {
+	vector<uint32_t> ids(dict.size());
+	for(uint32_t id = 0; id < ids.size(); ++id)
+		ids[id] = id;
+	sort(begin(ids), end(ids), [&dict, &less](uint32_t l, uint32_t r) {
+		return less(dict.value(l), dict.value(r));
+	});
+
+	vector<uint32_t> ranks(ids.size());
+	for(uint32_t i = 0; i < ids.size(); ++i)
+		ranks[ids[i]] = i;
+	return ranks;
+}
+
+// Sorts the distinct values of all the groupping columns once.
+column_keys rank_keys(groupby::groupper const& g, arguments const& args) {
+	column_keys result;
+	uint32_t i = 0;
+	for(auto const& dim : args.dimensions)
+		for(uint32_t col : dim) {
+			if(col >= result.dictionaries.size()) {
+				result.dictionaries.resize(col + 1);
+				result.smart_ranks.resize(col + 1);
+				result.lexical_ranks.resize(col + 1);
+			}
+			groupby::dictionary const& dict = g.get_dictionary(i++);
+			result.dictionaries[col] = &dict;
+			result.smart_ranks[col] = rank_values(dict, smart_less);
+			result.lexical_ranks[col] = rank_values(dict,
+				[](string const& l, string const& r) { return l < r; });
+		}
+	return result;
+}
+
 vector<groupby::group_result> sort_group_results(
 		vector<groupby::group_result> const& results,
+		column_keys const& keys,
 		arguments const& args) {
 
 	// Copy the input collection.
@@ -230,7 +307,7 @@ vector<groupby::group_result> sort_group_results(
 
 	// Sort the group by the dimensions.
 	sort(begin(groups), end(groups),
-			[&args](groupby::group_result const& lhs,
+			[&args, &keys](groupby::group_result const& lhs,
 				groupby::group_result const& rhs) {
 
 		for(auto const& dim : args.dimensions) {
@@ -239,10 +316,10 @@ vector<groupby::group_result> sort_group_results(
 			// dimension; return at the first that is not equal for the
 			// both groups.
 			for(auto const& i : dim) {
-				const string& l = lhs.get_def_at(i);	
-				const string& r = rhs.get_def_at(i);	
+				uint32_t l = lhs.get_id_at(i);
+				uint32_t r = rhs.get_id_at(i);
 				if(l != r)
-					return smart_less(l, r);
+					return keys.smart_ranks[i][l] < keys.smart_ranks[i][r];
 			}
 		}
 
@@ -254,15 +331,16 @@ vector<groupby::group_result> sort_group_results(
 	return groups;
 }
 
-typedef vector<pair<uint32_t, string>> dim_t;
+// The columns and the ids of their values.
+typedef vector<pair<uint32_t, uint32_t>> dim_t;
 
 // Creates an object defining a given dimension of a given group.
 inline dim_t group_dim(
 		groupby::group_result const& grp,
 		vector<uint32_t> const& dim) {
-	vector<pair<uint32_t, string>> result;
+	dim_t result;
 	for(uint32_t col : dim)
-		result.emplace_back(col, grp.get_def_at(col));
+		result.emplace_back(col, grp.get_id_at(col));
 	return result;
 }
 
@@ -272,16 +350,17 @@ inline string dim_caption(
 		dim_t d,
 		bool hide_domain,
 		bool has_map,
-		map<uint32_t, string> mapping) {
+		map<uint32_t, string> mapping,
+		column_keys const& keys) {
 
 	stringstream ss;
 	for(auto const& pr : d) {
 		if(hide_domain) {
-			ss << pr.second << " ";
+			ss << keys.value(pr.first, pr.second) << " ";
 		} else {
 			if(has_map) ss << mapping[pr.first];
 			else ss << pr.first;
-			ss << " = " << pr.second << " ";
+			ss << " = " << keys.value(pr.first, pr.second) << " ";
 		}
 	}
 	return ss.str();
@@ -289,31 +368,16 @@ inline string dim_caption(
 
 // Prints a caption for a given aggregator.
 inline string aggr_caption(
-		string aggr_str,
+		groupby::aggr_spec const& spec,
 		bool has_map,
 		map<uint32_t, string> mapping) {
 
-	// Parse the aggregator construction string.
-	smatch match;
-	sregex base_re = *_s >> (s1 = +_d) >> +_s >> (s2 = +_) >> eos;
-	if(!regex_match(aggr_str, match, base_re))
-		throw string("Unrecognize aggregator string \"") + aggr_str + "\".";
-
-	uint32_t field;
-	stringstream fieldss;
-	fieldss << match[1];
-	fieldss >> field;
-
-	if(fieldss.fail())
-		throw string("Failed parsing the field mapping of an ggregator.");
-
-	// Produce the result string.
 	stringstream ss;
 
 	if(has_map)
-		ss << match.str(2) << "(" << mapping[field] << ") ";
+		ss << spec.constr << "(" << mapping[spec.field] << ") ";
 	else
-		ss << match.str(2) << "(" << field << ") ";
+		ss << spec.constr << "(" << spec.field << ") ";
 
 	return ss.str();
 }
@@ -330,7 +394,7 @@ template<class It>
 void print_row(It grp_begin, It grp_end,
 		uint32_t dim_offset,
 		vector<dim_t> const& sorted_columns,
-		ostream& out,
+		output::writer& out,
 		arguments const& args) {
 
 	// Iterate over a sorted list of the columns.
@@ -350,7 +414,7 @@ void print_row(It grp_begin, It grp_end,
 				out << pr.second << args.delim;
 	}
 
-	out << endl;
+	out << '\n';
 }
 
 // Prints a page of the pivot table based on a range of the groupping results.
@@ -364,7 +428,9 @@ void print_page(It grp_begin, It grp_end,
 		bool hide_domain,
 		bool has_map,
 		map<uint32_t, string> mapping,
-		ostream& out,
+		vector<groupby::aggr_spec> const& specs,
+		column_keys const& keys,
+		output::writer& out,
 		arguments const& args) {
 
 	// Determine the page's columns.
@@ -375,7 +441,7 @@ void print_page(It grp_begin, It grp_end,
 
 	vector<dim_t> sorted_columns(begin(col_set), end(col_set));
 	sort(begin(sorted_columns), end(sorted_columns),
-		[&args](dim_t const& lhs, dim_t const& rhs) {
+		[&keys](dim_t const& lhs, dim_t const& rhs) {
 		
 			uint32_t num_defs = lhs.size();	
 
@@ -387,8 +453,10 @@ void print_page(It grp_begin, It grp_end,
 				if(lhs.at(i).first != rhs.at(i).first)
 					return lhs.at(i).first < rhs.at(i).first;
 
+				uint32_t col = lhs.at(i).first;
 				if(lhs.at(i).second != rhs.at(i).second)
-					return lhs.at(i).second < rhs.at(i).second;
+					return keys.lexical_ranks[col][lhs.at(i).second] <
+						keys.lexical_ranks[col][rhs.at(i).second];
 			}
 
 			return false;
@@ -408,11 +476,11 @@ void print_page(It grp_begin, It grp_end,
 		
 		// Print all the column captions.
 		for(dim_t const& d : sorted_columns)
-			for(string const& a : args.aggr_strs)
-				out << dim_caption(d, hide_domain, has_map, mapping) << ' '
+			for(groupby::aggr_spec const& a : specs)
+				out << dim_caption(d, hide_domain, has_map, mapping, keys) << ' '
 					<< aggr_caption(a, has_map, mapping)
 					<< args.delim;
-		out << endl;
+		out << '\n';
 	}
 
 	// Print all rows.
@@ -426,7 +494,7 @@ void print_page(It grp_begin, It grp_end,
 		if(group_row != current_row) {
 			if(args.print_headers) {
 				for(auto const& pr : current_row)
-					out << pr.second << " ";
+					out << keys.value(pr.first, pr.second) << " ";
 				out << args.delim;
 			}
 			print_row(row_begin, it, dim_offset, sorted_columns, out, args);
@@ -439,7 +507,7 @@ void print_page(It grp_begin, It grp_end,
 
 	if(args.print_headers) {
 		for(auto const& pr : current_row)
-			out << pr.second << " ";
+			out << keys.value(pr.first, pr.second) << " ";
 		out << args.delim;
 	}
 	print_row(row_begin, it, dim_offset, sorted_columns, out, args);
@@ -450,10 +518,15 @@ void print_table(groupby::groupper const& g,
 		bool hide_domain,
 		bool has_map,
 		map<uint32_t, string> mapping,
-		ostream& out,
+		output::writer& out,
 		arguments const& args) {
 
-	auto sorted_groups = sort_group_results(g.copy_result(), args);
+	column_keys keys = rank_keys(g, args);
+	auto sorted_groups = sort_group_results(g.copy_result(), keys, args);
+
+	// There is nothing to print, e.g. if the filter rejected all the rows.
+	if(sorted_groups.empty())
+		return;
 
 	if(args.dimensions.size() == 2) {
 
@@ -465,6 +538,8 @@ void print_table(groupby::groupper const& g,
 				hide_domain,
 				has_map,
 				mapping,
+				g.get_aggr_specs(),
+				keys,
 				out,
 				args);
 
@@ -486,8 +561,8 @@ void print_table(groupby::groupper const& g,
 				// Print current page.
 				if(args.print_headers)
 					out << "Page: "
-					    << dim_caption(current_page, hide_domain, has_map, mapping)
-					    << endl;
+					    << dim_caption(current_page, hide_domain, has_map, mapping, keys)
+					    << '\n';
 
 				print_page(page_begin,
 						it,
@@ -495,6 +570,8 @@ void print_table(groupby::groupper const& g,
 						hide_domain,
 						has_map,
 						mapping,
+						g.get_aggr_specs(),
+						keys,
 						out,
 						args);
 
@@ -508,8 +585,8 @@ void print_table(groupby::groupper const& g,
 		// Finalize the remaining page.
 		if(args.print_headers)
 			out << "Page: "
-			    << dim_caption(current_page, hide_domain, has_map, mapping)
-			    << endl;
+			    << dim_caption(current_page, hide_domain, has_map, mapping, keys)
+			    << '\n';
 
 		print_page(page_begin,
 				it,
@@ -517,6 +594,8 @@ void print_table(groupby::groupper const& g,
 				hide_domain,
 				has_map,
 				mapping,
+				g.get_aggr_specs(),
+				keys,
 				out,
 				args);
 
@@ -535,19 +614,26 @@ int main(int argc, char** argv) {
 		if(args.dimensions.size() != 2 && args.dimensions.size() != 3)
 			throw string("Only 2 or 3 dimensions are supported.");
 
+		// Open the input.
+		unique_ptr<input::source> in(args.input_path.empty()
+			? new input::source()
+			: new input::source(args.input_path));
+
 		// Headers variant.
 		map<uint32_t, string> mapping;
 		if(args.expect_data_header)
-			mapping = process_header(cin, args);
+			mapping = process_header(*in, args);
 
 		// Perform the processing.
-		groupby::groupper g = perform_groupping(cin, args);
+		groupby::groupper g = perform_groupping(*in, args);
+		output::writer out;
 		print_table(g,
 			args.hide_domain,
 			args.expect_data_header,
 			mapping,
-			cout,
+			out,
 			args);
+		out.flush();
 
 		return 0;
 
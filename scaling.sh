@@ -0,0 +1,50 @@
+#!/bin/sh
+
+# Measures the throughput of the groupby program versus the number of the
+# processing threads on a synthetic input, then the cost per row versus the
+# number of the distinct keys at the same number of rows.
+# Usage: ./scaling.sh [rows] [max-threads]
+
+ROWS=${1:-2000000}
+MAX_THREADS=${2:-$(nproc)}
+DATA=$(mktemp)
+
+awk -v rows=$ROWS 'BEGIN {
+	srand(1);
+	for(i = 0; i < rows; ++i)
+		printf "%d\t%d\t%.4f\n", int(rand() * 1000), int(rand() * 10), rand() * 100;
+}' > $DATA
+
+printf "threads\tseconds\trows_per_s\n"
+
+THREADS=1
+while [ $THREADS -le $MAX_THREADS ]; do
+	START=$(date +%s.%N)
+	./groupby -j $THREADS -g0 -g1 -a "2 mean" -a "2 stdev" $DATA > /dev/null
+	END=$(date +%s.%N)
+	awk -v t=$THREADS -v s=$START -v e=$END -v r=$ROWS \
+		'BEGIN { printf "%d\t%.3f\t%.0f\n", t, e - s, r / (e - s) }'
+	THREADS=$((THREADS * 2))
+done
+
+# With a constant time group lookup the cost per row should stay nearly flat
+# until the groups outgrow the caches. Creating and printing a group costs
+# more than finding it, so the number of the groups is shown as well.
+OUTPUT=$(mktemp)
+printf "\nkeys\tgroups\tseconds\tns_per_row\n"
+
+for KEYS in 100 1000 10000 100000 1000000; do
+	awk -v rows=$ROWS -v keys=$KEYS 'BEGIN {
+		srand(1);
+		for(i = 0; i < rows; ++i)
+			printf "%d\t%.4f\n", int(rand() * keys), rand() * 100;
+	}' > $DATA
+	START=$(date +%s.%N)
+	./groupby -g0 -a "1 mean" $DATA > $OUTPUT
+	END=$(date +%s.%N)
+	GROUP_COUNT=$(($(wc -l < $OUTPUT) - 1))
+	awk -v k=$KEYS -v g=$GROUP_COUNT -v s=$START -v e=$END -v r=$ROWS \
+		'BEGIN { printf "%d\t%d\t%.3f\t%.1f\n", k, g, e - s, (e - s) * 1e9 / r }'
+done
+
+rm -f $DATA $OUTPUT
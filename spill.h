@@ -0,0 +1,355 @@
+/* Copyright (C) 2012,2013 Krzysztof Stachowiak */
+
+/* 
+ * This file is part of stat-toolkit.
+ * 
+ * stat-toolkit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * stat-toolkit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with stat-toolkit; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <cstdint>
+
+#include <cstdlib>
+using std::getenv;
+
+#include <cerrno>
+
+#include <cstring>
+using std::memcpy;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <atomic>
+using std::atomic;
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace spill {
+
+// Creates a temporary file and returns its descriptor. The file is unlinked
+// as soon as it is created, so it disappears with the process even if the
+// process is killed. It is created in the TMPDIR directory or in the /tmp if
+// the variable isn't set.
+inline int open_temporary() {
+	char const* tmp = getenv("TMPDIR");
+	string pattern = string(tmp ? tmp : "/tmp") + "/stat-toolkit-XXXXXX";
+	vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+
+	int fd = mkstemp(path.data());
+	if(fd < 0)
+		throw string("Failed creating a temporary file in \"") +
+			(tmp ? tmp : "/tmp") + "\".";
+	unlink(path.data());
+	return fd;
+}
+
+// Reads the given number of bytes of a file starting at a given offset.
+inline void read_at(int fd, uint64_t offset, void* data, size_t size) {
+	char* current = (char*)data;
+	while(size > 0) {
+		ssize_t done = pread(fd, current, size, offset);
+		if(done < 0 && errno == EINTR)
+			continue;
+		if(done <= 0)
+			throw string("Failed reading a temporary file.");
+		current += done;
+		size -= done;
+		offset += done;
+	}
+}
+
+// A temporary file for the data that doesn't fit in the memory. The data is
+// appended with write() and may be read at any offset with read(), which
+// doesn't change the state of the file, so many readers may share it.
+class temp_file {
+	int _fd;
+	uint64_t _size;
+
+	temp_file(temp_file const&);
+	temp_file& operator=(temp_file const&);
+
+public:
+	temp_file() : _fd(open_temporary()), _size(0) {}
+
+	~temp_file() {
+		close(_fd);
+	}
+
+	// Appends the given bytes to the file.
+	void write(void const* data, size_t size) {
+		char const* current = (char const*)data;
+		while(size > 0) {
+			ssize_t done = ::write(_fd, current, size);
+			if(done < 0 && errno == EINTR)
+				continue;
+			if(done <= 0)
+				throw string("Failed writing a temporary file.");
+			current += done;
+			size -= done;
+			_size += done;
+		}
+	}
+
+	// Reads the given number of bytes starting at a given offset.
+	void read(uint64_t offset, void* data, size_t size) const {
+		read_at(_fd, offset, data, size);
+	}
+
+	// Gets the number of the bytes written so far.
+	uint64_t size() const {
+		return _size;
+	}
+};
+
+// The single temporary file of the process shared by the extents below, so
+// that any number of them takes one file descriptor. The space is reserved
+// in the multiples of a page at the end of the file, so many threads may
+// write their extents at once. The space of a released extent is returned
+// to the file system by punching a hole, where it is supported; otherwise
+// the file only grows until the process ends.
+class shared_file {
+	static const uint64_t ALIGNMENT = 4096;
+
+	int _fd;
+	atomic<uint64_t> _end;
+
+	shared_file() : _fd(open_temporary()), _end(0) {}
+	shared_file(shared_file const&);
+	shared_file& operator=(shared_file const&);
+
+public:
+	~shared_file() {
+		close(_fd);
+	}
+
+	// The file is created by the first call.
+	static shared_file& instance() {
+		static shared_file file;
+		return file;
+	}
+
+	// Rounds a size up to the reserved space.
+	static uint64_t reserved(uint64_t size) {
+		return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	// Reserves the space for a given number of bytes, returns its offset.
+	uint64_t reserve(uint64_t size) {
+		return _end.fetch_add(reserved(size));
+	}
+
+	// Frees the space reserved at a given offset.
+	void release(uint64_t offset, uint64_t size) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+		// A failure only leaves the space in use.
+		if(reserved(size) > 0)
+			fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				offset, reserved(size));
+#else
+		(void)offset;
+		(void)size;
+#endif
+	}
+
+	// Writes the given bytes at a given offset.
+	void write(uint64_t offset, void const* data, size_t size) {
+		char const* current = (char const*)data;
+		while(size > 0) {
+			ssize_t done = pwrite(_fd, current, size, offset);
+			if(done < 0 && errno == EINTR)
+				continue;
+			if(done <= 0)
+				throw string("Failed writing a temporary file.");
+			current += done;
+			size -= done;
+			offset += done;
+		}
+	}
+
+	void read(uint64_t offset, void* data, size_t size) const {
+		read_at(_fd, offset, data, size);
+	}
+};
+
+// A part of the shared file of a capacity known in advance, e.g. a sorted
+// run. It is written and read the same way as a temporary file of its own,
+// but without holding a file descriptor, so that there may be as many of
+// them as the disk holds.
+class extent {
+	uint64_t _offset;
+	uint64_t _capacity;
+	uint64_t _size;
+
+	extent(extent const&);
+	extent& operator=(extent const&);
+
+public:
+	explicit extent(uint64_t capacity) :
+		_offset(shared_file::instance().reserve(capacity)),
+		_capacity(capacity), _size(0) {}
+
+	~extent() {
+		shared_file::instance().release(_offset, _capacity);
+	}
+
+	// Appends the given bytes, up to the capacity.
+	void write(void const* data, size_t size) {
+		if(size > _capacity - _size)
+			throw string("Writing past the end of a spilled extent.");
+		shared_file::instance().write(_offset + _size, data, size);
+		_size += size;
+	}
+
+	// Reads the given number of bytes starting at a given offset.
+	void read(uint64_t offset, void* data, size_t size) const {
+		shared_file::instance().read(_offset + offset, data, size);
+	}
+
+	// Gets the number of the bytes written so far.
+	uint64_t size() const {
+		return _size;
+	}
+};
+
+// Appends the data to a temporary file through a buffer, so that the small
+// pieces don't cost a system call each. The buffer must be flushed before
+// the file is read.
+class writer {
+	static const size_t BUFFER_SIZE = 1 << 16;
+
+	temp_file* _file;
+	vector<char> _buffer;
+
+public:
+	explicit writer(temp_file& file) : _file(&file) {
+		_buffer.reserve(BUFFER_SIZE);
+	}
+
+	void write(void const* data, size_t size) {
+		if(_buffer.size() + size > BUFFER_SIZE)
+			flush();
+		if(size > BUFFER_SIZE) {
+			_file->write(data, size);
+			return;
+		}
+		char const* bytes = (char const*)data;
+		_buffer.insert(_buffer.end(), bytes, bytes + size);
+	}
+
+	// Writes the bytes of a value of a plain type.
+	template<class T>
+	void write_value(T const& value) {
+		write(&value, sizeof(T));
+	}
+
+	void flush() {
+		_file->write(_buffer.data(), _buffer.size());
+		_buffer.clear();
+	}
+};
+
+// Reads the data of a temporary file from the beginning through a buffer.
+class stream_reader {
+	static const size_t BLOCK_SIZE = 1 << 16;
+
+	temp_file const* _file;
+	uint64_t _offset;
+	vector<char> _block;
+	size_t _pos;
+
+public:
+	explicit stream_reader(temp_file const& file) :
+		_file(&file), _offset(0), _pos(0) {}
+
+	// Reads a given number of bytes. Returns false at the end of the file,
+	// throws if the file ends in the middle of the requested data.
+	bool read(void* data, size_t size) {
+		char* current = (char*)data;
+		bool started = false;
+		while(size > 0) {
+			if(_pos == _block.size()) {
+				uint64_t left = _file->size() - _offset;
+				if(left == 0) {
+					if(started)
+						throw string("Unexpected end of a temporary file.");
+					return false;
+				}
+				_block.resize(left < BLOCK_SIZE ? left : BLOCK_SIZE);
+				_file->read(_offset, _block.data(), _block.size());
+				_offset += _block.size();
+				_pos = 0;
+			}
+			size_t chunk = _block.size() - _pos;
+			if(chunk > size)
+				chunk = size;
+			memcpy(current, _block.data() + _pos, chunk);
+			_pos += chunk;
+			current += chunk;
+			size -= chunk;
+			started = true;
+		}
+		return true;
+	}
+
+	// Reads the bytes of a value of a plain type.
+	template<class T>
+	bool read_value(T& value) {
+		return read(&value, sizeof(T));
+	}
+};
+
+// Reads the values of a plain type T written one after another to a
+// temporary file or an extent. The values are fetched in blocks, so that the
+// memory used doesn't depend on the size of the file.
+template<class T, class STORE = temp_file>
+class reader {
+	static const size_t BLOCK_SIZE = 8192;
+
+	STORE const* _file;
+	uint64_t _offset;
+	vector<T> _block;
+	size_t _pos;
+
+public:
+	explicit reader(STORE const& file) :
+		_file(&file), _offset(0), _pos(0) {}
+
+	// Fetches the next value. Returns false at the end of the file.
+	bool next(T& value) {
+		if(_pos == _block.size()) {
+			uint64_t left = (_file->size() - _offset) / sizeof(T);
+			if(left == 0)
+				return false;
+			_block.resize(left < BLOCK_SIZE ? left : BLOCK_SIZE);
+			_file->read(_offset, _block.data(), _block.size() * sizeof(T));
+			_offset += _block.size() * sizeof(T);
+			_pos = 0;
+		}
+		value = _block[_pos++];
+		return true;
+	}
+};
+
+}
+
+#endif